@@ -0,0 +1,175 @@
+#!/usr/bin/env python
+#
+# bench.py -- scaling benchmark for comparator
+#
+# Generates synthetic corpora with benchgen.py at several scales, then
+# times comparator building SCFs, comparing the SCFs, and comparing the
+# trees directly.  Phase times inside a comparison run are taken from
+# the --stats dump.  Results are written as JSON so runs can be
+# compared mechanically.
+#
+# SPDX-License-Identifier: BSD-2-clause
+
+from __future__ import print_function
+import sys, os, re, time, json, shutil, getopt, tempfile, subprocess
+import benchgen
+
+# Phases of a comparison run reported by --stats, in order
+phasenames = ("scf_read", "sort", "compact", "reduce",
+              "collapse", "filter", "emit")
+
+def vmhwm(pid):
+    "Peak resident set of a running process, in KB, or None."
+    try:
+        fp = open("/proc/%d/status" % pid)
+        for line in fp:
+            if line.startswith("VmHWM:"):
+                fp.close()
+                return int(line.split()[1])
+        fp.close()
+    except (IOError, OSError, ValueError):
+        pass
+    return None
+
+def run(comparator, args, cwd):
+    "Run comparator, returning (elapsed, peak RSS in KB, stderr text)."
+    errfile = tempfile.TemporaryFile()
+    start = time.time()
+    child = subprocess.Popen([comparator] + args, cwd=cwd,
+                             stdout=open(os.devnull, "w"), stderr=errfile)
+    # The rusage of a child forked from this interpreter counts our own
+    # resident set, so sample the child's high-water mark while it runs.
+    peak = None
+    while True:
+        (pid, status, rusage) = os.wait4(child.pid, os.WNOHANG)
+        if pid:
+            break
+        hwm = vmhwm(child.pid)
+        if hwm is not None:
+            peak = max(peak or 0, hwm)
+        time.sleep(0.005)
+    elapsed = time.time() - start
+    errfile.seek(0)
+    err = errfile.read().decode("utf-8", "replace")
+    errfile.close()
+    if status:
+        sys.stderr.write("bench: %s %s failed\n" % (comparator, " ".join(args)))
+        sys.stderr.write(err)
+        sys.exit(1)
+    if peak is None:
+        peak = rusage.ru_maxrss
+    return (elapsed, peak, err)
+
+def phase_times(statsfile):
+    "Extract per-phase times and peak RSS from a --stats dump."
+    fp = open(statsfile)
+    stats = json.load(fp)
+    fp.close()
+    return (dict([(name, stats["phases"][name]["seconds"])
+                  for name in phasenames]),
+            stats["peak_rss_kb"])
+
+def shred_count(err):
+    "Extract the total shred count from -v output."
+    total = 0
+    for m in re.finditer(r"([0-9]+) (?:total chunks|shreds)", err):
+        total += int(m.group(1))
+    return total
+
+def record(results, scale, phase, secs, lines, shreds, rss):
+    entry = {
+        "scale": scale,
+        "phase": phase,
+        "seconds": round(secs, 6),
+        "lines": lines,
+        "shreds": shreds,
+        "lines_per_sec": round(lines / secs, 1) if secs else None,
+        "shreds_per_sec": round(shreds / secs, 1) if secs else None,
+        "maxrss_kb": rss,
+        }
+    results.append(entry)
+    print("%10d %-12s %9.3fs %12s lines/s %12s shreds/s %8d KB" %
+          (scale, phase, secs,
+           entry["lines_per_sec"], entry["shreds_per_sec"], rss))
+
+def bench(comparator, workdir, scales, ntrees, dupfrac, seed, opts):
+    results = []
+    for scale in scales:
+        corpus = os.path.join(workdir, "scale-%d" % scale)
+        if os.path.isdir(corpus):
+            shutil.rmtree(corpus)
+        os.makedirs(corpus)
+        trees = benchgen.generate(corpus, ntrees, scale, dupfrac, seed)
+        names = [os.path.basename(t) for (t, f, l) in trees]
+        lines = sum([l for (t, f, l) in trees])
+
+        # Shredding and SCF writing
+        secs = shreds = rss = 0
+        for name in names:
+            (t, r, err) = run(comparator, opts + ["-v", "-c", name], corpus)
+            secs += t
+            rss = max(rss, r)
+            shreds += shred_count(err)
+        record(results, scale, "shred", secs, lines, shreds, rss)
+
+        # Comparison from SCFs
+        statsfile = os.path.join(corpus, "stats.json")
+        (secs, rss, err) = run(comparator,
+                               opts + ["--stats=" + statsfile]
+                               + [n + ".scf" for n in names],
+                               corpus)
+        # Short runs can exit between samples; trust the self-report
+        (phases, peak) = phase_times(statsfile)
+        rss = max(rss, peak)
+        record(results, scale, "scf-compare", secs, lines, shreds, rss)
+        for phase in phasenames:
+            record(results, scale, phase, phases[phase], lines, shreds, rss)
+
+        # Comparison straight from the trees
+        (secs, rss, err) = run(comparator, opts + ["-v"] + names, corpus)
+        record(results, scale, "tree-compare", secs, lines, shreds, rss)
+
+        shutil.rmtree(corpus)
+    return results
+
+if __name__ == '__main__':
+    try:
+        (optlist, args) = getopt.getopt(sys.argv[1:], 'c:d:l:o:s:t:w:')
+    except getopt.GetoptError:
+        sys.stderr.write("usage: bench.py [-c comparator] [-l scale,...] [-t trees] [-d dupfrac] [-s seed] [-w workdir] [-o results]\n")
+        sys.exit(2)
+    comparator = os.path.abspath("comparator")
+    scales = [10000, 100000, 1000000]
+    ntrees = 2
+    dupfrac = 0.1
+    seed = 42
+    workdir = "bench"
+    output = "bench-results.json"
+    for (opt, val) in optlist:
+        if opt == '-c':
+            comparator = os.path.abspath(val)
+        elif opt == '-l':
+            scales = [int(x) for x in val.split(",")]
+        elif opt == '-t':
+            ntrees = int(val)
+        elif opt == '-d':
+            dupfrac = float(val)
+        elif opt == '-s':
+            seed = int(val)
+        elif opt == '-w':
+            workdir = val
+        elif opt == '-o':
+            output = val
+    opts = ["-N", "line-oriented, remove-braces, remove-whitespace"]
+    results = bench(comparator, workdir, scales, ntrees, dupfrac, seed, opts)
+    fp = open(output, "w")
+    json.dump({"comparator": comparator,
+               "seed": seed,
+               "trees": ntrees,
+               "dupfrac": dupfrac,
+               "results": results}, fp, indent=1, sort_keys=True)
+    fp.write("\n")
+    fp.close()
+    print("Results written to %s" % output)
+
+# End
@@ -0,0 +1,191 @@
+#!/usr/bin/env python
+#
+# benchgen.py -- generate synthetic source trees for benchmarking comparator
+#
+# Makes a set of trees full of C, shell, and prose files with a controlled
+# amount of planted duplication: a fraction of each tree's text is drawn
+# from a shared pool of blocks, so comparing the trees finds a known-size
+# set of common segments.  Output is entirely determined by the seed.
+#
+# SPDX-License-Identifier: BSD-2-clause
+
+from __future__ import print_function
+import sys, os, random, getopt
+
+words = """the of and to in is that for it as was with be by on not he this
+are or his from at which but have an they you were her she there one all we
+their has been would will if more when no so can said who what about other
+into them some could time these two may then do first any my now such like
+our over man me even most made after also did many before must through back
+years where much your way well down should because each just those people
+how too little state good very make world still own see men work long get
+here between both life being under never day same another know while last
+might us great old year off come since against go came right used take three
+""".split()
+
+types = ["int", "char *", "long", "unsigned", "struct node *", "double", "void"]
+ops = ["+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>"]
+cmps = ["<", ">", "==", "!=", "<=", ">="]
+shellcmds = ["echo", "cat", "grep", "sed", "awk", "sort", "cut", "tr",
+             "rm -f", "cp", "mv", "test -f", "mkdir -p"]
+
+def ident(rng):
+    return rng.choice(words) + "_" + rng.choice(words)
+
+def c_function(rng):
+    "Generate a plausible C function as a list of lines."
+    name = ident(rng)
+    args = ", ".join("%s %s" % (rng.choice(types), ident(rng))
+                     for i in range(rng.randint(0, 3))) or "void"
+    out = ["", "static %s %s(%s)" % (rng.choice(types), name, args), "{"]
+    for i in range(rng.randint(1, 4)):
+        out.append("    %s %s;" % (rng.choice(types), ident(rng)))
+    out.append("")
+    for i in range(rng.randint(3, 25)):
+        r = rng.random()
+        if r < 0.5:
+            out.append("    %s = %s %s %d;" % (ident(rng), ident(rng),
+                                              rng.choice(ops),
+                                              rng.randint(0, 1000)))
+        elif r < 0.7:
+            out.append("    if (%s %s %s)" % (ident(rng), rng.choice(cmps),
+                                             ident(rng)))
+            out.append("    {")
+            out.append("\t%s(%s);" % (ident(rng), ident(rng)))
+            out.append("\tbreak;")
+            out.append("    }")
+        elif r < 0.85:
+            out.append("    for (i = 0; i < %s; i++)" % ident(rng))
+            out.append("\t%s[i] = %s(i);" % (ident(rng), ident(rng)))
+        elif r < 0.95:
+            out.append("    /* %s */" % " ".join(rng.choice(words)
+                                               for j in range(rng.randint(3, 12))))
+        else:
+            out.append("    return %s;" % ident(rng))
+    out.append("    return 0;")
+    out.append("}")
+    return out
+
+def shell_block(rng):
+    "Generate a chunk of shell script."
+    out = []
+    for i in range(rng.randint(3, 15)):
+        r = rng.random()
+        if r < 0.6:
+            out.append("%s %s %s" % (rng.choice(shellcmds), ident(rng),
+                                     ident(rng)))
+        elif r < 0.8:
+            out.append("if [ -n \"$%s\" ]; then" % ident(rng).upper())
+            out.append("    %s $%s" % (rng.choice(shellcmds),
+                                       ident(rng).upper()))
+            out.append("fi")
+        else:
+            out.append("# %s" % " ".join(rng.choice(words)
+                                         for j in range(rng.randint(2, 10))))
+    return out
+
+def prose_block(rng):
+    "Generate a paragraph of text."
+    out = []
+    for i in range(rng.randint(2, 12)):
+        out.append(" ".join(rng.choice(words)
+                            for j in range(rng.randint(6, 14))).capitalize())
+    out.append("")
+    return out
+
+generators = {"c": c_function, "sh": shell_block, "txt": prose_block}
+
+def make_pool(rng, nblocks):
+    "Build the pool of blocks that get planted in more than one tree."
+    pool = []
+    for i in range(nblocks):
+        kind = rng.choice(["c", "c", "c", "sh", "txt"])
+        pool.append((kind, generators[kind](rng)))
+    return pool
+
+def make_file(rng, kind, nlines, pool, dupfrac):
+    "Make the lines of one file of the given kind."
+    lines = []
+    if kind == "sh":
+        lines.append("#!/bin/sh")
+    elif kind == "c":
+        lines.append("#include <stdio.h>")
+    while len(lines) < nlines:
+        if pool and rng.random() < dupfrac:
+            candidates = [b for (k, b) in pool if k == kind]
+            if candidates:
+                lines.extend(rng.choice(candidates))
+                continue
+        lines.extend(generators[kind](rng))
+    return lines
+
+def make_tree(root, seed, totallines, pool, dupfrac, filelines=300, fanout=8):
+    "Generate one tree with approximately the given number of lines."
+    rng = random.Random(seed)
+    made = 0
+    count = 0
+    while made < totallines:
+        kind = rng.choice(["c", "c", "c", "c", "h", "sh", "txt", "noext"])
+        depth = rng.randint(0, 3)
+        subdir = os.path.join(root, *["d%d" % rng.randint(0, fanout - 1)
+                                      for i in range(depth)])
+        if not os.path.isdir(subdir):
+            os.makedirs(subdir)
+        if kind == "noext":
+            name = os.path.join(subdir, "%s%d" % (rng.choice(words).upper(),
+                                                  count))
+            kind = "txt"
+        elif kind == "h":
+            name = os.path.join(subdir, "f%d.h" % count)
+            kind = "c"
+        else:
+            name = os.path.join(subdir, "f%d.%s" % (count, kind))
+        lines = make_file(rng, kind,
+                          rng.randint(filelines // 4, filelines * 2),
+                          pool, dupfrac)
+        fp = open(name, "w")
+        fp.write("\n".join(lines) + "\n")
+        fp.close()
+        made += len(lines)
+        count += 1
+    return (count, made)
+
+def generate(outdir, ntrees, totallines, dupfrac, seed):
+    "Generate a benchmark corpus, returning a list of (tree, files, lines)."
+    rng = random.Random(seed)
+    pool = make_pool(rng, 200)
+    result = []
+    for t in range(ntrees):
+        tree = os.path.join(outdir, "tree%d" % t)
+        (files, lines) = make_tree(tree, seed * 1000 + t, totallines,
+                                   pool, dupfrac)
+        result.append((tree, files, lines))
+    return result
+
+if __name__ == '__main__':
+    try:
+        (optlist, args) = getopt.getopt(sys.argv[1:], 'd:l:s:t:')
+    except getopt.GetoptError:
+        sys.stderr.write("usage: benchgen.py [-l lines] [-t trees] [-d dupfrac] [-s seed] outdir\n")
+        sys.exit(2)
+    totallines = 100000
+    ntrees = 2
+    dupfrac = 0.1
+    seed = 42
+    for (opt, val) in optlist:
+        if opt == '-l':
+            totallines = int(val)
+        elif opt == '-t':
+            ntrees = int(val)
+        elif opt == '-d':
+            dupfrac = float(val)
+        elif opt == '-s':
+            seed = int(val)
+    if len(args) != 1:
+        sys.stderr.write("benchgen.py: need exactly one output directory\n")
+        sys.exit(2)
+    for (tree, files, lines) in generate(args[0], ntrees, totallines,
+                                         dupfrac, seed):
+        print("%s: %d files, %d lines" % (tree, files, lines))
+
+# End
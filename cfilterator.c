@@ -0,0 +1,795 @@
+/*
+ * cfilterator.c -- compiled equivalent of filterator
+ *
+ * Reads an SCF-B report (either encoding) on standard input, applies
+ * the same -m, -f and -F clique filters as the Python filterator, and
+ * either lists the common code or (with -n) writes a filtered SCF-B.
+ * Each source file is mapped once and indexed by line, so extracting
+ * the text of a clique is a single slice rather than a re-read.
+ *
+ * SPDX-License-Identifier: BSD-2-clause
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <regex.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <netinet/in.h>
+
+#define DIVIDER	"---------------------------------------------------------------------------\n"
+
+struct file_t		/* a file mentioned in the report */
+{
+    char	*name;
+    unsigned	length;		/* length in lines, from the report */
+    int		tree;		/* index into tree table, -1 if unknown */
+    char	*map;		/* mapped contents, if we've needed them */
+    size_t	size;
+    size_t	*lines;		/* offset of the start of each line */
+    unsigned	nlines;
+    bool	failed;		/* we tried to map this and couldn't */
+};
+
+struct range_t
+{
+    int		file;
+    unsigned	start, end;
+};
+
+struct tree_t
+{
+    char	*name;
+    int		nprops;
+    char	*props[8];	/* property names, in sorted order */
+    long	values[8];
+};
+
+/* report metadata */
+static char *filtering, *merge_program, *normalization;
+static int shred_size, matches_hdr = -1;
+
+static struct tree_t *trees;
+static int ntrees;
+
+static struct file_t *files;
+static int nfiles, files_alloc;
+
+static struct range_t *ranges;
+static unsigned nranges, ranges_alloc;
+static unsigned *cliques;	/* index of first range of each clique */
+static unsigned ncliques, cliques_alloc;
+
+/*************************************************************************
+ *
+ * Utility functions
+ *
+ *************************************************************************/
+
+static void fatal(const char *msg, const char *arg)
+{
+    fprintf(stderr, "filterator: ");
+    fprintf(stderr, msg, arg);
+    fputc('\n', stderr);
+    exit(1);
+}
+
+static void *xrealloc(void *p, size_t n)
+{
+    if ((p = realloc(p, n)) == NULL)
+	fatal("out of memory%s", "");
+    return(p);
+}
+
+static int tree_of(const char *name)
+/* which tree in the properties block does a filename belong to? */
+{
+    const char *slash = strchr(name, '/');
+    size_t n = slash ? (size_t)(slash - name) : strlen(name);
+    int i;
+
+    for (i = 0; i < ntrees; i++)
+	if (strlen(trees[i].name) == n && !strncmp(trees[i].name, name, n))
+	    return(i);
+    return(-1);
+}
+
+static long *tree_prop(struct tree_t *tp, const char *prop)
+/* find a property slot in a tree */
+{
+    int i;
+
+    for (i = 0; i < tp->nprops; i++)
+	if (!strcmp(tp->props[i], prop))
+	    return(tp->values + i);
+    return(NULL);
+}
+
+/*************************************************************************
+ *
+ * File interning
+ *
+ *************************************************************************/
+
+static int *filehash;
+static unsigned filehash_size;
+
+static unsigned strhash(const char *s)
+/* FNV-1a, good enough for a symbol table */
+{
+    unsigned h = 2166136261u;
+
+    while (*s)
+	h = (h ^ (unsigned char)*s++) * 16777619u;
+    return(h);
+}
+
+static void rehash(void)
+{
+    int i;
+
+    filehash_size = filehash_size ? filehash_size * 2 : 1024;
+    filehash = (int *)xrealloc(filehash, sizeof(int) * filehash_size);
+    memset(filehash, -1, sizeof(int) * filehash_size);
+    for (i = 0; i < nfiles; i++)
+    {
+	unsigned h = strhash(files[i].name) & (filehash_size - 1);
+
+	while (filehash[h] != -1)
+	    h = (h + 1) & (filehash_size - 1);
+	filehash[h] = i;
+    }
+}
+
+static int intern_file(const char *name, unsigned length)
+/* return the index of a named file, creating it if need be */
+{
+    unsigned h;
+
+    if (2 * (nfiles + 1) > filehash_size)
+	rehash();
+    h = strhash(name) & (filehash_size - 1);
+    while (filehash[h] != -1)
+    {
+	if (!strcmp(files[filehash[h]].name, name))
+	{
+	    files[filehash[h]].length = length;
+	    return(filehash[h]);
+	}
+	h = (h + 1) & (filehash_size - 1);
+    }
+
+    if (nfiles >= files_alloc)
+    {
+	files_alloc = files_alloc ? files_alloc * 2 : 256;
+	files = (struct file_t *)xrealloc(files, sizeof(struct file_t) * files_alloc);
+    }
+    memset(files + nfiles, 0, sizeof(struct file_t));
+    files[nfiles].name = strdup(name);
+    files[nfiles].length = length;
+    files[nfiles].tree = tree_of(name);
+    filehash[h] = nfiles;
+    return(nfiles++);
+}
+
+static void add_range(int file, unsigned start, unsigned end)
+{
+    if (nranges >= ranges_alloc)
+    {
+	ranges_alloc = ranges_alloc ? ranges_alloc * 2 : 1024;
+	ranges = (struct range_t *)xrealloc(ranges, sizeof(struct range_t) * ranges_alloc);
+    }
+    ranges[nranges].file = file;
+    ranges[nranges].start = start;
+    ranges[nranges].end = end;
+    nranges++;
+}
+
+static void add_clique(unsigned first)
+/* start a clique; there is always room for a sentinel after the last */
+{
+    if (ncliques + 2 > cliques_alloc)
+    {
+	cliques_alloc = cliques_alloc ? cliques_alloc * 2 : 1024;
+	cliques = (unsigned *)xrealloc(cliques, sizeof(unsigned) * cliques_alloc);
+    }
+    cliques[ncliques++] = first;
+}
+
+/*************************************************************************
+ *
+ * Report parsing
+ *
+ *************************************************************************/
+
+static char *slurp(FILE *fp, size_t *lenp)
+/* read all of a stream into core */
+{
+    size_t len = 0, alloc = BUFSIZ * 16;
+    char *buf = (char *)xrealloc(NULL, alloc + 1);
+    size_t n;
+
+    while ((n = fread(buf + len, 1, alloc - len, fp)) > 0)
+    {
+	len += n;
+	if (len == alloc)
+	{
+	    alloc *= 2;
+	    buf = (char *)xrealloc(buf, alloc + 1);
+	}
+    }
+    buf[len] = '\0';
+    *lenp = len;
+    return(buf);
+}
+
+static char *getline_at(char **cpp, char *end)
+/* split off the next line of an in-core buffer, NUL-terminating it */
+{
+    char *line = *cpp, *nl;
+
+    if (line >= end)
+	return(NULL);
+    if ((nl = memchr(line, '\n', end - line)) == NULL)
+	nl = end;
+    *nl = '\0';
+    *cpp = nl + 1;
+    return(line);
+}
+
+static int propsort(const void *a, const void *b)
+{
+    return strcmp(*(char **)a, *(char **)b);
+}
+
+static void parse_tree(char *line)
+/* parse a tree-properties line */
+{
+    char *colon = strchr(line, ':'), *cp;
+    struct tree_t *tp;
+
+    if (!colon)
+	fatal("malformed tree properties line: %s", line);
+    trees = (struct tree_t *)xrealloc(trees, sizeof(struct tree_t) * (ntrees + 1));
+    tp = trees + ntrees++;
+    memset(tp, 0, sizeof(struct tree_t));
+    *colon = '\0';
+    tp->name = strdup(line);
+    for (cp = strtok(colon + 1, ","); cp && tp->nprops < 8; cp = strtok(NULL, ","))
+    {
+	char *eq = strchr(cp, '=');
+
+	if (!eq)
+	    continue;
+	*eq = '\0';
+	while (*cp == ' ')
+	    cp++;
+	tp->props[tp->nprops] = strdup(cp);
+	tp->values[tp->nprops] = atol(eq + 1);
+	tp->nprops++;
+    }
+    /* keep the property names sorted, so values follow their names */
+    {
+	char *names[8];
+	long values[8];
+	int i, j;
+
+	memcpy(names, tp->props, sizeof(names));
+	qsort(names, tp->nprops, sizeof(char *), propsort);
+	for (i = 0; i < tp->nprops; i++)
+	    for (j = 0; j < tp->nprops; j++)
+		if (names[i] == tp->props[j])
+		    values[i] = tp->values[j];
+	memcpy(tp->props, names, sizeof(names));
+	memcpy(tp->values, values, sizeof(values));
+    }
+}
+
+static void parse_text(char *cp, char *end)
+/* parse the range sets of a text-encoded SCF-B */
+{
+    char *line;
+    unsigned first = nranges;
+
+    while ((line = getline_at(&cp, end)) != NULL)
+    {
+	char *f1, *f2, *f3;
+
+	if (!strcmp(line, "%%"))
+	{
+	    add_clique(first);
+	    first = nranges;
+	    continue;
+	}
+	/* filename:start:end:length, and the filename may contain colons */
+	if ((f3 = strrchr(line, ':')) == NULL)
+	    continue;
+	*f3 = '\0';
+	if ((f2 = strrchr(line, ':')) == NULL)
+	    continue;
+	*f2 = '\0';
+	if ((f1 = strrchr(line, ':')) == NULL)
+	    continue;
+	*f1 = '\0';
+	add_range(intern_file(line, atoi(f3 + 1)),
+		  atoi(f1 + 1), atoi(f2 + 1));
+    }
+}
+
+static unsigned get_uint(const char *p)
+{
+    u_int32_t v;
+
+    memcpy(&v, p, sizeof(v));
+    return(ntohl(v));
+}
+
+static void parse_binary(char *buf, char *cp, char *end)
+/* parse the range sets of a binary-encoded SCF-B */
+{
+    unsigned nf, nr, nc, ss, i, *index;
+    char *fileidx, *cliqueidx, *recs, *strtab;
+
+    /* the binary part starts at an 8-byte boundary of the report */
+    cp += (8 - (cp - buf) % 8) % 8;
+    if (end - cp < 16)
+	fatal("truncated binary report%s", "");
+    nf = get_uint(cp);
+    nr = get_uint(cp + 4);
+    nc = get_uint(cp + 8);
+    ss = get_uint(cp + 12);
+    fileidx = cp + 16;
+    cliqueidx = fileidx + 16 * (size_t)nf;
+    recs = cliqueidx + 4 * ((size_t)nc + 1);
+    strtab = recs + 16 * (size_t)nr + 4 * (size_t)nr;
+    if (strtab + ss > end)
+	fatal("truncated binary report%s", "");
+
+    index = (unsigned *)xrealloc(NULL, sizeof(unsigned) * (nf + 1));
+    for (i = 0; i < nf; i++)
+	index[i] = intern_file(strtab + get_uint(fileidx + 16 * i),
+			       get_uint(fileidx + 16 * i + 4));
+    for (i = 0; i < nr; i++)
+    {
+	char *rp = recs + 16 * i;
+
+	add_range(index[get_uint(rp)], get_uint(rp + 4), get_uint(rp + 8));
+    }
+    for (i = 0; i < nc; i++)
+	add_clique(get_uint(cliqueidx + 4 * i));
+    free(index);
+}
+
+static void parse_report(char *buf, size_t len)
+/* parse an SCF-B report held in core */
+{
+    char *cp = buf, *end = buf + len, *line;
+    bool binary = false;
+
+    if ((line = getline_at(&cp, end)) == NULL || strncmp(line, "#SCF-B ", 7))
+	fatal("input is not a SCF-B file.%s", "");
+
+    while ((line = getline_at(&cp, end)) != NULL && strcmp(line, "%%"))
+    {
+	char *value = strchr(line, ':');
+
+	if (!value)
+	    continue;
+	*value++ = '\0';
+	while (*value == ' ')
+	    value++;
+	if (!strcmp(line, "Normalization"))
+	    normalization = strdup(value);
+	else if (!strcmp(line, "Shred-Size"))
+	    shred_size = atoi(value);
+	else if (!strcmp(line, "Merge-Program"))
+	    merge_program = strdup(value);
+	else if (!strcmp(line, "Matches"))
+	    matches_hdr = atoi(value);
+	else if (!strcmp(line, "Filtering"))
+	    filtering = strdup(value);
+	else if (!strcmp(line, "Encoding"))
+	    binary = !strcmp(value, "binary");
+    }
+
+    while ((line = getline_at(&cp, end)) != NULL && strcmp(line, "%%"))
+	parse_tree(line);
+
+    if (binary)
+	parse_binary(buf, cp, end);
+    else
+	parse_text(cp, end);
+    add_clique(nranges);	/* sentinel */
+    ncliques--;
+
+    if (matches_hdr >= 0 && (unsigned)matches_hdr != ncliques)
+	fatal("Matches field not equal to clique count.%s", "");
+}
+
+/*************************************************************************
+ *
+ * Clique filtering
+ *
+ *************************************************************************/
+
+static void cliquefilter(bool (*predicate)(const struct range_t *, void *),
+			 void *arg)
+/* keep only cliques with at least one range satisfying the predicate */
+{
+    unsigned c, kept = 0, out = 0;
+
+    for (c = 0; c < ncliques; c++)
+    {
+	unsigned r, first = cliques[c], last = cliques[c+1];
+	bool keep = false;
+
+	for (r = first; r < last; r++)
+	    if (predicate(ranges + r, arg))
+	    {
+		keep = true;
+		break;
+	    }
+
+	if (keep)
+	{
+	    cliques[kept++] = out;
+	    for (r = first; r < last; r++)
+		ranges[out++] = ranges[r];
+	}
+	else
+	    /* correct the statistics for each clique not kept */
+	    for (r = first; r < last; r++)
+	    {
+		int t = files[ranges[r].file].tree;
+		long *vp;
+
+		if (t < 0)
+		    continue;
+		if ((vp = tree_prop(trees + t, "matches")) != NULL)
+		    (*vp)--;
+		if ((vp = tree_prop(trees + t, "matchlines")) != NULL)
+		    *vp -= ranges[r].end - ranges[r].start + 1;
+	    }
+    }
+    ncliques = kept;
+    nranges = out;
+    cliques[ncliques] = nranges;
+}
+
+static bool minsize_pred(const struct range_t *rp, void *arg)
+{
+    return(rp->end - rp->start + 1 >= *(unsigned *)arg);
+}
+
+static bool regex_pred(const struct range_t *rp, void *arg)
+{
+    return(regexec((regex_t *)arg, files[rp->file].name, 0, NULL, 0) == 0);
+}
+
+static bool matchfile_pred(const struct range_t *rp, void *arg)
+{
+    return(files[rp->file].tree != -2);
+}
+
+static void preen(void)
+/* recompute the tree properties after filtering */
+{
+    unsigned c, r;
+    int t;
+
+    for (t = 0; t < ntrees; t++)
+    {
+	long *vp;
+
+	if ((vp = tree_prop(trees + t, "matches")) != NULL)
+	    *vp = 0;
+	if ((vp = tree_prop(trees + t, "matchlines")) != NULL)
+	    *vp = 0;
+    }
+    for (c = 0; c < ncliques; c++)
+    {
+	bool intree[ntrees + 1];
+
+	memset(intree, 0, sizeof(intree));
+	for (r = cliques[c]; r < cliques[c+1]; r++)
+	{
+	    long *vp;
+
+	    if ((t = files[ranges[r].file].tree) < 0)
+		continue;
+	    if (!intree[t] && (vp = tree_prop(trees + t, "matches")) != NULL)
+	    {
+		(*vp)++;
+		intree[t] = true;
+	    }
+	    if ((vp = tree_prop(trees + t, "matchlines")) != NULL)
+		*vp += ranges[r].end - ranges[r].start + 1;
+	}
+    }
+}
+
+/*************************************************************************
+ *
+ * Text extraction
+ *
+ *************************************************************************/
+
+#define MAX_MAPPED	1024	/* cap on simultaneously mapped files */
+
+static int mapped[MAX_MAPPED], nmapped, nextevict;
+
+static void unmap_file(struct file_t *fp)
+{
+    if (fp->map)
+	munmap(fp->map, fp->size);
+    free(fp->lines);
+    fp->map = NULL;
+    fp->lines = NULL;
+}
+
+static bool map_file(int f)
+/* map a source file and build its line-offset table */
+{
+    struct file_t *fp = files + f;
+    struct stat sb;
+    char *cp, *end;
+    unsigned alloc;
+    int fd;
+
+    if (fp->lines)
+	return(true);
+    else if (fp->failed)
+	return(false);
+
+    if ((fd = open(fp->name, O_RDONLY)) < 0 || fstat(fd, &sb) < 0)
+    {
+	if (fd >= 0)
+	    close(fd);
+	fp->failed = true;
+	return(false);
+    }
+    fp->size = sb.st_size;
+    fp->map = NULL;
+    if (fp->size > 0)
+    {
+	fp->map = mmap(NULL, fp->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (fp->map == MAP_FAILED)
+	{
+	    close(fd);
+	    fp->map = NULL;
+	    fp->failed = true;
+	    return(false);
+	}
+    }
+    close(fd);
+
+    alloc = fp->length + 2;
+    fp->lines = (size_t *)xrealloc(NULL, sizeof(size_t) * alloc);
+    fp->nlines = 0;
+    fp->lines[0] = 0;
+    for (cp = fp->map, end = fp->map + fp->size; cp < end; )
+    {
+	char *nl = memchr(cp, '\n', end - cp);
+
+	cp = nl ? nl + 1 : end;
+	if (fp->nlines + 2 > alloc)
+	{
+	    alloc *= 2;
+	    fp->lines = (size_t *)xrealloc(fp->lines, sizeof(size_t) * alloc);
+	}
+	fp->lines[++fp->nlines] = cp - fp->map;
+    }
+
+    /* don't let the mapped set grow without bound */
+    if (nmapped == MAX_MAPPED)
+    {
+	unmap_file(files + mapped[nextevict]);
+	mapped[nextevict] = f;
+	nextevict = (nextevict + 1) % MAX_MAPPED;
+    }
+    else
+	mapped[nmapped++] = f;
+    return(true);
+}
+
+static void emit_text(const struct range_t *rp, FILE *ofp)
+/* emit the text of a range, escaping leading % as filterator does */
+{
+    struct file_t *fp = files + rp->file;
+    unsigned i;
+
+    for (i = rp->start; i <= rp->end && i <= fp->nlines; i++)
+    {
+	const char *line = fp->map + fp->lines[i-1];
+
+	if (*line == '%')
+	    fputc('%', ofp);
+	fwrite(line, 1, fp->lines[i] - fp->lines[i-1], ofp);
+    }
+}
+
+/*************************************************************************
+ *
+ * Output
+ *
+ *************************************************************************/
+
+static void metadump(FILE *ofp, const char *divider, int minsize, bool listing)
+/* dump the header in a canonical format */
+{
+    int t, i;
+
+    fprintf(ofp, "Filtering: %s\n", filtering ? filtering : "None");
+    fputs("Filter-Program: filterator 1.0\n", ofp);
+    fputs("Hash-Method: RXOR\n", ofp);
+    fprintf(ofp, "Matches: %u\n", ncliques);
+    if (merge_program)
+	fprintf(ofp, "Merge-Program: %s\n", merge_program);
+    fprintf(ofp, "Normalization: %s\n", normalization ? normalization : "None");
+    fprintf(ofp, "Shred-Size: %d\n", shred_size);
+    if (listing)
+	fprintf(ofp, "Minimum-Size: %d\n", minsize);
+    fputs(divider, ofp);
+    for (t = 0; t < ntrees; t++)
+    {
+	fprintf(ofp, "%s:", trees[t].name);
+	for (i = 0; i < trees[t].nprops; i++)
+	    fprintf(ofp, " %s=%ld%s", trees[t].props[i], trees[t].values[i],
+		    (i < trees[t].nprops - 1) ? "," : "");
+	fputc('\n', ofp);
+    }
+    fputs(divider, ofp);
+}
+
+static void longreport(unsigned c, FILE *ofp)
+/* list a clique and the text of its first member */
+{
+    unsigned r, first = cliques[c], last = cliques[c+1];
+
+    if (first == last)
+	return;
+    if (!map_file(ranges[first].file))
+	fatal("no such file as %s", files[ranges[first].file].name);
+    for (r = first; r < last; r++)
+    {
+	struct file_t *fp = files + ranges[r].file;
+
+	fprintf(ofp, "%% %s:%u-%u:%s\n", fp->name,
+		ranges[r].start, ranges[r].end,
+		(ranges[r].start == 1 && ranges[r].end == fp->length) ? " (entire)" : "");
+    }
+    emit_text(ranges + first, ofp);
+    fputs(DIVIDER, ofp);
+}
+
+static void cliquedump(unsigned c, FILE *ofp)
+/* dump a clique in a form identical to the input one */
+{
+    unsigned r;
+
+    for (r = cliques[c]; r < cliques[c+1]; r++)
+	fprintf(ofp, "%s:%u:%u:%u\n", files[ranges[r].file].name,
+		ranges[r].start, ranges[r].end, files[ranges[r].file].length);
+    fputs("%%\n", ofp);
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "usage: cfilterator [-n] [-d dir] [-m size] [-f filter] [-F matchfile]\n");
+    exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+    extern char	*optarg;
+    int		status, minsize = 5, f;
+    bool	expand = true;
+    char	*dir = NULL, *matchfile = NULL, *buf;
+    regex_t	filter, *filterp = NULL;
+    size_t	len;
+    static char	obuf[BUFSIZ * 64];
+    unsigned	c;
+
+    while ((status = getopt(argc, argv, "d:f:F:m:n")) != EOF)
+    {
+	switch (status)
+	{
+	case 'd':
+	    dir = optarg;
+	    break;
+
+	case 'f':
+	    if (regcomp(&filter, optarg, REG_EXTENDED | REG_NOSUB))
+		fatal("bad filter regexp %s", optarg);
+	    filterp = &filter;
+	    break;
+
+	case 'F':
+	    matchfile = optarg;
+	    break;
+
+	case 'm':
+	    minsize = atoi(optarg);
+	    break;
+
+	case 'n':
+	    expand = false;
+	    break;
+
+	default:
+	    usage();
+	}
+    }
+
+    buf = slurp(stdin, &len);
+    parse_report(buf, len);
+
+    if (minsize)
+	cliquefilter(minsize_pred, &minsize);
+    if (filterp)
+	cliquefilter(regex_pred, filterp);
+    if (matchfile)
+    {
+	FILE	*mfp = fopen(matchfile, "r");
+	char	line[BUFSIZ];
+	int	*saved;
+
+	if (!mfp)
+	    fatal("can't open %s", matchfile);
+	/* mark the listed files by borrowing the tree field */
+	saved = (int *)xrealloc(NULL, sizeof(int) * (nfiles + 1));
+	for (f = 0; f < nfiles; f++)
+	    saved[f] = files[f].tree;
+	while (fgets(line, sizeof(line), mfp))
+	{
+	    char *cp = line + strlen(line);
+	    unsigned h;
+
+	    while (cp > line && (cp[-1] == '\n' || cp[-1] == ' ' || cp[-1] == '\t' || cp[-1] == '\r'))
+		*--cp = '\0';
+	    for (cp = line; *cp == ' ' || *cp == '\t'; cp++)
+		continue;
+	    if (!filehash_size)
+		continue;
+	    for (h = strhash(cp) & (filehash_size - 1); filehash[h] != -1; h = (h + 1) & (filehash_size - 1))
+		if (!strcmp(files[filehash[h]].name, cp))
+		{
+		    files[filehash[h]].tree = -2;
+		    break;
+		}
+	}
+	fclose(mfp);
+	cliquefilter(matchfile_pred, NULL);
+	for (f = 0; f < nfiles; f++)
+	    files[f].tree = saved[f];
+	free(saved);
+    }
+
+    if (dir && chdir(dir) != 0)
+	fatal("can't change directory to %s", dir);
+
+    setvbuf(stdout, obuf, _IOFBF, sizeof(obuf));
+    if (expand)
+    {
+	metadump(stdout, DIVIDER, minsize, true);
+	for (c = 0; c < ncliques; c++)
+	    longreport(c, stdout);
+    }
+    else
+    {
+	preen();
+	fputs("#SCF-B 2.0\n", stdout);
+	metadump(stdout, "%%\n", minsize, false);
+	for (c = 0; c < ncliques; c++)
+	    cliquedump(c, stdout);
+    }
+
+    exit(0);
+}
+
+/* cfilterator.c ends here */
@@ -46,6 +46,8 @@ class CommonReport:
                 self.matches = int(value)
             elif tag == "Filtering":
                 self.filtering = value
+            elif tag == "Encoding" and value != "text":
+                raise ComparatorException("can't read %s SCF-B encoding.\n" % value)
         # Read file properties
         self.trees = []
         while 1:
@@ -0,0 +1,107 @@
+/*
+ * dispatch.c -- run the comparator engine for the hash method in use
+ *
+ * The engine (everything but this file) is compiled once per hash
+ * method, so the width of a hash is a constant in every sort, compare
+ * and reduce loop.  The Makefile links the builds together with only
+ * their entry points left visible, and this picks one per run: the
+ * method named by --hash if there is one, else that of the first SCF
+ * on the command line (-C inputs included) or of the --resume
+ * checkpoint, else RXOR.
+ *
+ * SPDX-License-Identifier: BSD-2-clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdbool.h>
+
+extern int rxor_main(int argc, char *argv[]);
+extern int md5_main(int argc, char *argv[]);
+
+/* options of the engine that take a separate argument */
+#define SHORT_ARGS	"CdjmNoPsw"
+#define INPUT_ARGS	"C"	/* ...which is an input like the others */
+static const char *long_args[] = {"--checkpoint", "--hash", "--resume",
+				  "--stats", NULL};
+
+static char *scf_method(const char *file)
+/* return the Hash-Method of an SCF, NULL if it isn't one or doesn't say */
+{
+    char	buf[BUFSIZ], *method = NULL;
+    FILE	*fp = fopen(file, "r");
+
+    if (!fp)
+	return(NULL);
+    if (fgets(buf, sizeof(buf), fp)
+	&& (!strncmp(buf, "#SCF-A ", 7) || !strncmp(buf, "#SCF-C ", 7)))
+	while (fgets(buf, sizeof(buf), fp) && strcmp(buf, "%%\n"))
+	    if (!strncmp(buf, "Hash-Method:", 12))
+	    {
+		method = buf + 12 + strspn(buf + 12, " ");
+		method[strcspn(method, "\n")] = '\0';
+		method = strdup(method);
+		break;
+	    }
+    fclose(fp);
+    return(method);
+}
+
+int main(int argc, char *argv[])
+{
+    const char	*method = NULL;
+    bool	options = true;
+    int		i;
+
+    for (i = 1; i < argc; i++)
+    {
+	char	*arg = argv[i];
+
+	if (options && !strcmp(arg, "--"))
+	    options = false;
+	else if (options && !strncmp(arg, "--", 2))
+	{
+	    const char	**lp;
+
+	    if (!strncmp(arg, "--hash=", 7))
+		method = arg + 7;
+	    else if (!strcmp(arg, "--hash") && i + 1 < argc)
+		method = argv[i + 1];
+	    else if (!strncmp(arg, "--resume=", 9) && method == NULL)
+		method = scf_method(arg + 9);
+	    else if (!strcmp(arg, "--resume") && i + 1 < argc && method == NULL)
+		method = scf_method(argv[i + 1]);
+	    for (lp = long_args; *lp; lp++)
+		if (!strcmp(arg, *lp))
+		    i++;
+	}
+	else if (options && arg[0] == '-' && arg[1])
+	{
+	    char	*cp;
+
+	    /* an option taking an argument ends the cluster */
+	    for (cp = arg + 1; *cp; cp++)
+		if (strchr(SHORT_ARGS, *cp))
+		{
+		    char	*value = cp[1] ? cp + 1 : argv[i + 1];
+
+		    if (strchr(INPUT_ARGS, *cp) && value && method == NULL)
+			method = scf_method(value);
+		    if (cp[1] == '\0')
+			i++;
+		    break;
+		}
+	}
+	else if (method == NULL)
+	    method = scf_method(arg);
+    }
+
+    if (method && !strcasecmp(method, "MD5"))
+	return(md5_main(argc, argv));
+    else
+	return(rxor_main(argc, argv));
+}
+
+/* dispatch.c ends here */
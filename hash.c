@@ -72,8 +72,9 @@ Other good material is at <http://burtleburtle.net/bob/hash/>.
 
 /* following code only relies on hashval_t being an integral type */
 
-static hashval_t hstate;
-static int cind;
+/* one hash is in progress per shredding thread */
+static __thread hashval_t hstate;
+static __thread int cind;
 
 void hash_init(void)
 {
@@ -109,7 +110,7 @@ char *hash_dump(hashval_t hash)
 #else	/* use MD5 rather than the custom hash */
 #include "md5.h"
 
-static struct md5_ctx	ctx;
+static __thread struct md5_ctx	ctx;
 
 void hash_init(void)
 {
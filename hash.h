@@ -2,6 +2,9 @@
 
 /* SPDX-License-Identifier: BSD-2-clause */
 
+#ifndef HASH_H
+#define HASH_H
+
 #include <stdint.h>
 
 #ifndef FORCE_MD5
@@ -19,4 +22,6 @@ void hash_update(unsigned char *buffer, const int len);
 void hash_complete(hashval_t *hp);
 char *hash_dump(hashval_t hash);
 
+#endif /* HASH_H */
+
 /* hash.h ends */
@@ -0,0 +1,394 @@
+/*
+ * kernbench.c -- microbenchmarks for comparator's inner-loop kernels
+ *
+ * Times hash_update(), normalize(), filter_pass() and emit_chunk() in
+ * isolation over canned mixes of C, shell, prose and very long lines,
+ * plus any files named on the command line.  Build it with and without
+ * -DFORCE_MD5 to compare the hash methods; the Makefile makes both.
+ * Cycle counts come from the timestamp counter, so on CPUs that scale
+ * their clock they are reference cycles rather than core cycles.
+ *
+ * SPDX-License-Identifier: BSD-2-clause
+ */
+
+/*
+ * normalize(), filter_pass() and emit_chunk() are file-static, so pull
+ * in the analyzer and shredder whole rather than widening their
+ * interfaces just for the benefit of this driver.
+ */
+#include "linebyline.c"
+#include "shredtree.c"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+/* shredtree.c wants these from main.c */
+int verbose, debug;
+
+static char *c_lines[] = {
+    "#include <stdio.h>\n",
+    "static int frobnicate(struct node *np, int count)\n",
+    "{\n",
+    "    int i, total = 0;\n",
+    "\n",
+    "    for (i = 0; i < count; i++)\n",
+    "\ttotal += np->weights[i] * scale_factor; /* accumulate */\n",
+    "    if (total > MAX_TOTAL)\n",
+    "    {\n",
+    "\tfprintf(stderr, \"frobnicate: overflow at %d\\n\", i);\n",
+    "\treturn -1;\n",
+    "    }\n",
+    "    return 0;\n",
+    "}\n",
+    "#define ARRAY_SIZE(a)\t(sizeof(a) / sizeof(*(a)))\n",
+    "\tbreak;\n",
+};
+
+static char *shell_lines[] = {
+    "#!/bin/sh\n",
+    "# rebuild the index if anything changed\n",
+    "for f in $SOURCES; do\n",
+    "    if [ \"$f\" -nt \"$INDEX\" ]; then\n",
+    "        echo \"rebuilding: $f is newer\" >&2\n",
+    "        rm -f \"$INDEX\" && make index\n",
+    "    fi\n",
+    "done\n",
+    "case \"$1\" in\n",
+    "    -v) verbose=1; shift ;;\n",
+    "esac\n",
+    "exit 0\n",
+};
+
+static char *prose_lines[] = {
+    "The comparator tool reports common segments between source trees.\n",
+    "It works by breaking each file into overlapping shreds of lines,\n",
+    "hashing them, and sorting the hashes so that duplicates end up\n",
+    "adjacent.\n",
+    "\n",
+    "Significance filtering throws away matches made of pure syntax,\n",
+    "such as runs of closing braces or bare return statements.\n",
+};
+
+struct mix_t
+{
+    const char	*name;
+    int		mode;		/* analyzer mode the mix is scanned in */
+    char	**lines;
+    int		nlines;
+};
+
+#define MAXMIXES	16
+static struct mix_t mixes[MAXMIXES];
+static int nmixes;
+static u_int64_t target_ns = 200000000;	/* time each measurement this long */
+
+static void add_mix(const char *name, int mode, char **lines, int nlines)
+/* register a line mix to be benchmarked */
+{
+    struct mix_t *mp = mixes + nmixes++;
+
+    mp->name = name;
+    mp->mode = mode;
+    mp->lines = lines;
+    mp->nlines = nlines;
+}
+
+static char **long_lines(int *np)
+/* generate lines a few KB long, the kind found in generated code */
+{
+    static char *lines[4];
+    int i;
+
+    for (i = 0; i < 4; i++)
+    {
+	char *cp = lines[i] = malloc(BUFSIZ / 2);
+
+	cp += sprintf(cp, "static const int table%d[] = {", i);
+	while (cp - lines[i] < BUFSIZ / 2 - 16)
+	    cp += sprintf(cp, " %d,", (int)(cp - lines[i]) * (i + 7));
+	strcpy(cp, " };\n");
+    }
+    *np = 4;
+    return(lines);
+}
+
+static char **file_lines(const char *file, int *np)
+/* slurp a file as an array of lines */
+{
+    FILE *fp = fopen(file, "r");
+    char buf[BUFSIZ], **lines = NULL;
+    int n = 0, alloc = 0;
+
+    if (fp == NULL)
+    {
+	fprintf(stderr, "kernbench: couldn't open %s, %s\n",
+		file, strerror(errno));
+	exit(1);
+    }
+    while (fgets(buf, sizeof(buf), fp))
+    {
+	if (n >= alloc)
+	{
+	    alloc = 2 * alloc + 64;
+	    lines = (char **)realloc(lines, sizeof(char *) * alloc);
+	}
+	lines[n++] = strdup(buf);
+    }
+    fclose(fp);
+    *np = n;
+    return(lines);
+}
+
+static u_int64_t cycles(void)
+/* CPU timestamp counter, where there is one */
+{
+#ifdef HAVE_TSC
+    return(__rdtsc());
+#else
+    return(0);
+#endif
+}
+
+/*
+ * Each kernel does one pass over a mix and returns the number of bytes
+ * it consumed.  The volatile sink keeps the compiler from discarding
+ * work whose result nobody looks at.
+ */
+static volatile int sink;
+static char scratch[BUFSIZ];
+
+static long k_copy(struct mix_t *mp)
+/* baseline: the copy every in-place kernel has to start with */
+{
+    long bytes = 0;
+    int i;
+
+    for (i = 0; i < mp->nlines; i++)
+    {
+	int len = strlen(mp->lines[i]);
+
+	memcpy(scratch, mp->lines[i], len + 1);
+	sink += scratch[0];
+	bytes += len;
+    }
+    return(bytes);
+}
+
+static long k_hash(struct mix_t *mp)
+/* hash each line as a one-line shred */
+{
+    long bytes = 0;
+    int i;
+
+    for (i = 0; i < mp->nlines; i++)
+    {
+	hashval_t hv;
+	int len = strlen(mp->lines[i]);
+
+	hash_init();
+	hash_update((unsigned char *)mp->lines[i], len);
+	hash_complete(&hv);
+	sink += ((unsigned char *)&hv)[0];
+	bytes += len;
+    }
+    return(bytes);
+}
+
+static long k_normalize(struct mix_t *mp)
+/* normalize each line with every option on */
+{
+    long bytes = 0;
+    int i;
+
+    for (i = 0; i < mp->nlines; i++)
+    {
+	int len = strlen(mp->lines[i]);
+
+	memcpy(scratch, mp->lines[i], len + 1);
+	sink += normalize(scratch);
+	bytes += len;
+    }
+    return(bytes);
+}
+
+static long k_filter(struct mix_t *mp)
+/* run the significance filter over each line */
+{
+    long bytes = 0;
+    int i;
+
+    for (i = 0; i < mp->nlines; i++)
+    {
+	sink += filter_pass(mp->lines[i]);
+	bytes += strlen(mp->lines[i]);
+    }
+    return(bytes);
+}
+
+static long k_emit(struct mix_t *mp)
+/* slide a shred window over the lines, hashing it at each one */
+{
+    shred ring[256];
+    long bytes = 0;
+    int i, j, first = 0;
+
+    for (j = 0; j < shredsize; j++)
+    {
+	ring[j].feature = mp->lines[j % mp->nlines];
+	ring[j].length = strlen(ring[j].feature);
+	ring[j].start = j + 1;
+	ring[j].flags = 0;
+    }
+    for (i = 0; i < mp->nlines; i++)
+    {
+	struct hash_t out;
+
+	for (j = 0; j < shredsize; j++)
+	    bytes += ring[j].length;
+	out = emit_chunk(ring, first, i + shredsize);
+	sink += out.flags;
+
+	/* the oldest line leaves and the next one takes its slot */
+	ring[first].feature = mp->lines[(i + shredsize) % mp->nlines];
+	ring[first].length = strlen(ring[first].feature);
+	ring[first].start = i + shredsize + 1;
+	if (++first == shredsize)
+	    first = 0;
+    }
+    return(bytes);
+}
+
+struct kernel_t
+{
+    const char	*name;
+    long	(*run)(struct mix_t *);
+    bool	copies;		/* subtract the copy baseline */
+};
+
+static struct kernel_t kernels[] = {
+    {"hash_update",	k_hash,		false},
+    {"normalize",	k_normalize,	true},
+    {"filter_pass",	k_filter,	false},
+    {"emit_chunk",	k_emit,		false},
+};
+
+struct result_t
+{
+    double	ns, cycles, bytes, lines;
+};
+
+static struct result_t measure(long (*run)(struct mix_t *), struct mix_t *mp)
+/* repeat a kernel over a mix until enough time has passed */
+{
+    struct result_t r;
+    u_int64_t start, cstart, elapsed;
+    long passes = 0;
+
+    r.bytes = 0;
+    run(mp);			/* warm the caches */
+    start = monotonic_ns();
+    cstart = cycles();
+    do {
+	r.bytes += run(mp);
+	passes++;
+    } while
+	((elapsed = monotonic_ns() - start) < target_ns);
+    r.cycles = cycles() - cstart;
+    r.ns = elapsed;
+    r.lines = (double)passes * mp->nlines;
+    return(r);
+}
+
+static void usage(void)
+{
+    fprintf(stderr,"usage: kernbench [-m msec] [-s shredsize] [file...]\n");
+    fprintf(stderr,"  -m msec = time each measurement for this long (default %d)\n",
+	    (int)(target_ns / 1000000));
+    fprintf(stderr,"  -s size = shred size for emit_chunk (default %d)\n",
+	    shredsize);
+}
+
+int main(int argc, char *argv[])
+{
+    struct kernel_t *kp;
+    struct mix_t *mp;
+    char **longs;
+    int status, n;
+
+    while ((status = getopt(argc, argv, "hm:s:")) != EOF)
+    {
+	switch (status)
+	{
+	case 'm':
+	    target_ns = atoi(optarg) * 1000000ULL;
+	    break;
+
+	case 's':
+	    shredsize = atoi(optarg);
+	    if (shredsize < 1 || shredsize > 256)
+	    {
+		(void)fputs("kernbench: shred size must be 1..256.\n", stderr);
+		exit(1);
+	    }
+	    break;
+
+	case 'h':
+	default:
+	    usage();
+	    exit(0);
+	}
+    }
+
+    if (analyzer_init("line-oriented, remove-whitespace, remove-comments, remove-braces") != 0)
+    {
+	(void)fputs("kernbench: analyzer initialization failed.\n", stderr);
+	exit(1);
+    }
+
+    longs = long_lines(&n);
+    add_mix("c", C_CODE, c_lines, sizeof(c_lines)/sizeof(*c_lines));
+    add_mix("shell", SHELL_CODE,
+	    shell_lines, sizeof(shell_lines)/sizeof(*shell_lines));
+    add_mix("prose", 0, prose_lines, sizeof(prose_lines)/sizeof(*prose_lines));
+    add_mix("long", C_CODE, longs, n);
+    for (; optind < argc && nmixes < MAXMIXES; optind++)
+    {
+	char **lines = file_lines(argv[optind], &n);
+
+	if (n)
+	    add_mix(argv[optind], C_CODE, lines, n);
+    }
+
+    printf("# comparator %s kernels, %s hash, shred size %d\n",
+	   VERSION, HASHMETHOD, shredsize);
+    printf("%-12s %-16s %8s %12s %12s\n",
+	   "kernel", "mix", "bytes/ln", "ns/line", "bytes/cycle");
+    for (kp = kernels; kp < kernels + sizeof(kernels)/sizeof(*kernels); kp++)
+	for (mp = mixes; mp < mixes + nmixes; mp++)
+	{
+	    struct result_t r;
+
+	    analyzer_mode(mp->mode);
+	    r = measure(kp->run, mp);
+	    if (kp->copies)
+	    {
+		/* rates are per line, so scale the baseline to our count */
+		struct result_t base = measure(k_copy, mp);
+
+		r.ns -= base.ns * (r.lines / base.lines);
+		r.cycles -= base.cycles * (r.lines / base.lines);
+	    }
+	    printf("%-12s %-16.16s %8.1f %12.2f ",
+		   kp->name, mp->name, r.bytes / r.lines, r.ns / r.lines);
+	    if (r.cycles > 0)
+		printf("%12.3f\n", r.bytes / r.cycles);
+	    else
+		printf("%12s\n", "-");
+	}
+
+    exit(0);
+}
+
+/* kernbench.c ends here */
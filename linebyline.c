@@ -14,12 +14,24 @@ LICENSE
 #include <ctype.h>
 #include <string.h>
 #include <stdbool.h>
+#include <pthread.h>
 #include "shred.h"
 
-/* control bits */
-static bool remove_braces = false;
-static bool remove_whitespace = false;
-static bool remove_comments = false;
+/*
+ * Control bits.  Each analyzer_init() call sets up another set of
+ * them, so a tree can be shredded under several normalizations in one
+ * pass; a thread picks the set it's working for with analyzer_select().
+ */
+struct options_t
+{
+    bool	remove_braces;
+    bool	remove_whitespace;
+    bool	remove_comments;
+};
+#define MAX_OPTIONS	8
+static struct options_t options[MAX_OPTIONS];
+static int noptions;
+static __thread struct options_t *opts = options;
 
 static char *c_patterns[] = {
     /* Idioms that don't convey any meaning in isolation */
@@ -47,83 +59,184 @@ static char *c_patterns[] = {
     " EINVAL ",
     " ENOSYS ",
 };
-static regex_t c_regexps[sizeof(c_patterns)/sizeof(*c_patterns)];
+#define NC_PATTERNS	(sizeof(c_patterns)/sizeof(*c_patterns))
 
 static char *shell_patterns[] = {
     " break ", " case ", " done ", " do ", " else ", " esac ", " exit *[01]?",
     " false ", " fi ", " for", " function", " if ", " return ", " shift ", 
     " true ", "until", " while ", 
 };
-static regex_t shell_regexps[sizeof(shell_patterns)/sizeof(*shell_patterns)];
+#define NSHELL_PATTERNS	(sizeof(shell_patterns)/sizeof(*shell_patterns))
+
+/*
+ * Files are shredded by several threads at once, so everything the
+ * analyzer keeps about the file in progress is per-thread.  That goes
+ * for the compiled patterns too, because some regexec() implementations
+ * serialize all matching against one regex_t.
+ */
+struct patterns_t
+{
+    regex_t	c[NC_PATTERNS];
+    regex_t	shell[NSHELL_PATTERNS];
+};
+static __thread struct patterns_t *patterns;
+static pthread_key_t patterns_key;
+static pthread_once_t patterns_once = PTHREAD_ONCE_INIT;
+
+/*
+ * Trees are full of identical lines -- closing braces, "break;",
+ * license boilerplate -- and each one costs a trip through the regex
+ * loop.  The verdict depends only on the normalized text and the mode,
+ * so a small direct-mapped cache per thread remembers it for recent
+ * lines, whichever normalization produced them.  The shred hashes
+ * can't be cached this way, because both hash methods depend on where
+ * in the shred a line's bytes fall.
+ */
+#define LINECACHE_SLOTS		65536	/* a power of two */
+#define LINECACHE_MAXLEN	128	/* longer lines rarely repeat */
+struct cacheline_t
+{
+    u_int32_t	key;		/* hash of the normalized line */
+    unsigned char mode;		/* analyzer mode it was seen in */
+    int		flags;		/* filter_pass() verdict */
+    char	*text;		/* normalized line, NULL if slot empty */
+};
+static __thread struct cacheline_t *linecache;
+static pthread_key_t linecache_key;
 
-static linenum_t	linecount;
+static __thread linenum_t	linecount;
 
-int analyzer_init(const char *buf)
-/* initialize line filtering */
+static void free_patterns(void *arg)
+/* release a thread's compiled patterns when it exits */
 {
+    struct patterns_t *pp = (struct patterns_t *)arg;
     int i;
-    char	*cp;
 
-    for (i = 0; i < sizeof(c_patterns)/sizeof(*c_patterns); i++)
-	if (regcomp(c_regexps+i, c_patterns[i], REG_EXTENDED))
+    for (i = 0; i < NC_PATTERNS; i++)
+	regfree(pp->c + i);
+    for (i = 0; i < NSHELL_PATTERNS; i++)
+	regfree(pp->shell + i);
+    free(pp);
+}
+
+static void free_linecache(void *arg)
+/* release a thread's line cache when it exits */
+{
+    struct cacheline_t *cp, *cache = (struct cacheline_t *)arg;
+
+    for (cp = cache; cp < cache + LINECACHE_SLOTS; cp++)
+	free(cp->text);
+    free(cache);
+}
+
+static void make_patterns_key(void)
+{
+    pthread_key_create(&patterns_key, free_patterns);
+    pthread_key_create(&linecache_key, free_linecache);
+}
+
+static void compile_patterns(void)
+/* compile this thread's copy of the filter patterns */
+{
+    int i;
+
+    patterns = (struct patterns_t *)malloc(sizeof(struct patterns_t));
+    for (i = 0; i < NC_PATTERNS; i++)
+	if (regcomp(patterns->c+i, c_patterns[i], REG_EXTENDED))
 	{
 	    fprintf(stderr, "comparator: error while compiling %s\n",
 		    c_patterns[i]);
 	    exit(1);
 	}
-    for (i = 0; i < sizeof(shell_patterns)/sizeof(*shell_patterns); i++)
-	if (regcomp(shell_regexps+i, shell_patterns[i], REG_EXTENDED))
+    for (i = 0; i < NSHELL_PATTERNS; i++)
+	if (regcomp(patterns->shell+i, shell_patterns[i], REG_EXTENDED))
 	{
 	    fprintf(stderr, "comparator: error while compiling %s\n", 
 		    shell_patterns[i]);
 	    exit(1);
 	}
+    pthread_once(&patterns_once, make_patterns_key);
+    pthread_setspecific(patterns_key, patterns);
+}
 
+int analyzer_init(const char *buf)
+/* initialize line filtering */
+{
+    char	*cp;
+    struct options_t *op = options + noptions;
+
+    if (!patterns)
+	compile_patterns();
+
+    if (noptions >= MAX_OPTIONS)
+	return(-1);
     cp = strtok(strdup((const char *)buf), ", ");
-    if (strcmp(cp, "line-oriented"))
+    if (cp == NULL || strcmp(cp, "line-oriented"))
 	return(1);
     while (cp = strtok(NULL, ", "))
     {
 	if (strcmp(cp, "remove-whitespace") == 0)
-	    remove_whitespace = 1;
+	    op->remove_whitespace = 1;
 	else if (strcmp(cp, "remove-comments") == 0)
-	    remove_comments = 1;
+	    op->remove_comments = 1;
 	else if (strcmp(cp, "remove-braces") == 0)
-	    remove_braces = 1;
+	    op->remove_braces = 1;
 	else
 	    return(-1);
     }
+    noptions++;
     return(0);
 }
 
-static unsigned char	active = 0;
-static regex_t *regexps;
-static int nregexps;
+static __thread unsigned char	active = 0;
+static __thread regex_t *regexps;
+static __thread int nregexps;
 
 void analyzer_mode(int mask)
 /* set the analyzer mode -- meant to be called at the start of a file scan */
 {
     active = mask;
 
+    if (mask && !patterns)
+	compile_patterns();
     if (mask & C_CODE)
     {
-	regexps = c_regexps;
-	nregexps = sizeof(c_regexps)/sizeof(*c_regexps);
+	regexps = patterns->c;
+	nregexps = NC_PATTERNS;
     }
     else if (mask & SHELL_CODE)
     {
-	regexps = shell_regexps;
-	nregexps = sizeof(shell_regexps)/sizeof(*shell_regexps);
+	regexps = patterns->shell;
+	nregexps = NSHELL_PATTERNS;
     }
 
     /* this may have to be fixed someday! */
     linecount = 0;
 }
 
+void analyzer_resume(int mask, linenum_t line)
+/* set the mode for a scan starting after the given line of a file */
+{
+    analyzer_mode(mask);
+    linecount = line;
+}
+
+void analyzer_select(int n)
+/* make this thread normalize as the nth analyzer_init() call asked */
+{
+    opts = options + n;
+}
+
+int analyzer_current(void)
+/* report the mode, which the first line of a file may have changed */
+{
+    return(active);
+}
+
 static int normalize(char *buf)
 /* normalize a buffer in place, return 0 if it should be skipped */
 {
-    if (remove_comments)
+    if (opts->remove_comments)
     {
 	if (active & C_CODE)	/* remove C comments */
 	{
@@ -152,7 +265,7 @@ static int normalize(char *buf)
 	}
     }
 
-    if (remove_whitespace)	/* strip whitespace, ignore blank lines */
+    if (opts->remove_whitespace)	/* strip whitespace, ignore blank lines */
     {
 	char *tp, *sp;
 
@@ -161,7 +274,7 @@ static int normalize(char *buf)
 		*tp++ = *sp;
 	*tp = '\0';
     }
-    if (remove_braces)		/* strip C statement brackets */
+    if (opts->remove_braces)		/* strip C statement brackets */
     {
 	char *tp, *sp;
 
@@ -182,7 +295,7 @@ static int filter_pass(const char *line)
     else
     {
 	char	*sp, *tp;
-	char	buf[BUFSIZ];
+	char	buf[BUFSIZ+1];	/* a full line plus the leading space */
 	int	changed;
 
 	/* change all punctuation to spaces */
@@ -211,6 +324,7 @@ static int filter_pass(const char *line)
 	    {
 		regmatch_t f;
 
+		COUNT_HERE(regexec_calls, 1);
 		if (!regexec(re, buf, 1, &f, 0))
 		{
 		    char	*start, *end;
@@ -231,24 +345,73 @@ static int filter_pass(const char *line)
     }
 }
 
-feature_t *analyzer_get(const struct filehdr_t *file, FILE *fp, linenum_t *linenump)
+static struct cacheline_t *cache_slot(const char *line, size_t len, u_int32_t *keyp)
+/* find the cache slot for a line, NULL if it's too long to cache */
+{
+    u_int32_t	key = 2166136261U;
+    const char	*cp;
+
+    if (len > LINECACHE_MAXLEN)
+	return(NULL);
+    if (!linecache)
+    {
+	linecache = (struct cacheline_t *)calloc(LINECACHE_SLOTS,
+						 sizeof(struct cacheline_t));
+	pthread_once(&patterns_once, make_patterns_key);
+	pthread_setspecific(linecache_key, linecache);
+    }
+    for (cp = line; cp < line + len; cp++)	/* FNV-1a */
+	key = (key ^ (unsigned char)*cp) * 16777619U;
+    *keyp = key;
+    return(linecache + (key & (LINECACHE_SLOTS - 1)));
+}
+
+static int cached_filter(const char *line)
+/* filter_pass(), remembering the verdicts for short lines */
+{
+    struct cacheline_t *slot;
+    u_int32_t	key;
+    size_t	len;
+
+    if (active == 0)
+	return(0);
+    len = strlen(line);
+    if ((slot = cache_slot(line, len, &key)) == NULL)
+	return(filter_pass(line));
+    if (slot->text && slot->key == key && slot->mode == active
+	&& !strcmp(slot->text, line))
+    {
+	COUNT_HERE(linecache_hits, 1);
+	return(slot->flags);
+    }
+    COUNT_HERE(linecache_misses, 1);
+    free(slot->text);
+    slot->key = key;
+    slot->mode = active;
+    slot->flags = filter_pass(line);
+    slot->text = (char *)malloc(len + 1);
+    memcpy(slot->text, line, len + 1);
+    return(slot->flags);
+}
+
+feature_t *analyzer_get(const struct filehdr_t *file, struct source_t *src, linenum_t *linenump)
 /* get a feature (in this case, a line) from the input stream */
 {
     char	buf[BUFSIZ];
-    static feature_t	feature;
+    static __thread feature_t	feature;
 
-    while (fgets(buf, sizeof(buf), fp) != NULL)
+    while (source_gets(buf, sizeof(buf), src) != NULL)
     {
 	int	braceline = 0;
 
 	linecount++;
 	if (linecount >= MAX_LINENUM)
 	{
-	    fprintf(stderr, "comparator: %s too large, only first %d lines will be compared.\n", file->name, MAX_LINENUM-1);
+	    fprintf(stderr, "comparator: %s too large, only first %u lines will be compared.\n", file->name, MAX_LINENUM-1);
 	    break;
 	}
 
-	if (remove_braces)
+	if (opts->remove_braces)
 	{
 	    char *cp;
 
@@ -269,7 +432,7 @@ feature_t *analyzer_get(const struct filehdr_t *file, FILE *fp, linenum_t *linen
 
 	/* time to return the feature */
 	feature.text = strdup(buf);
-	feature.flags = filter_pass(buf) ? INSIGNIFICANT : 0;
+	feature.flags = cached_filter(buf) ? INSIGNIFICANT : 0;
 	*linenump = linecount;
 	return &feature;
     }
@@ -288,11 +451,11 @@ void analyzer_dump(char *buf)
 /* dump a Normalization line representing current options */
 {
     strcpy(buf, "line-oriented, ");
-    if (remove_whitespace)
+    if (opts->remove_whitespace)
 	strcat(buf, "remove-whitespace, ");
-    if (remove_comments)
+    if (opts->remove_comments)
 	strcat(buf, "remove-comments, ");
-    if (remove_braces)
+    if (opts->remove_braces)
 	strcat(buf, "remove-braces, ");
     if (buf[0])
 	buf[strlen(buf)-2] = '\0';
@@ -302,7 +465,10 @@ void analyzer_dump(char *buf)
 struct analyzer_t linebyline =
 {
     init: analyzer_init,
+    select: analyzer_select,
     mode: analyzer_mode,
+    resume: analyzer_resume,
+    current: analyzer_current,
     get:  analyzer_get,
     free: analyzer_free,
     dumpopt: analyzer_dump,
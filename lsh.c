@@ -0,0 +1,141 @@
+/*
+ * lsh.c -- MinHash signatures of files and LSH banding over them
+ *
+ * Comparing many trees, most pairs of files share nothing, yet all
+ * their shreds go through the global sort.  With --lsh each file gets a
+ * one-permutation MinHash signature as its shreds are read: the mixed
+ * hashes are split into bins by their top bits and the least of each
+ * bin kept.  The bins are then cut into bands, and files whose
+ * signatures agree over a whole band land in the same bucket.  Only
+ * the files that share a bucket with a file of another tree keep their
+ * shreds for the sort; with -C, one of the buckets' files must also
+ * be a candidate.  Fewer rows per band find fainter resemblances
+ * at the cost of keeping more files.  This is a heuristic: two files are
+ * only compared if their signatures agree over some band, and a small
+ * copy inside a big file may not make them do so.
+ *
+ * SPDX-License-Identifier: BSD-2-clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "shred.h"
+
+#define LSH_LOG2BINS	5
+#define LSH_BINS	(1 << LSH_LOG2BINS)	/* signature length */
+#define LSH_EMPTY	((u_int64_t)-1)		/* bin no shred fell in */
+
+int lsh_bands;			/* 0 turns the pre-pass off */
+
+struct bucket_t		/* one band of one file's signature */
+{
+    u_int64_t	key;
+    struct filehdr_t *file;
+};
+
+void lsh_add(struct filehdr_t *file, const hashval_t *hp)
+/* enter a shred's hash into its file's signature */
+{
+    u_int64_t	v = hash_mix(hp);
+    int		bin = v >> (64 - LSH_LOG2BINS);
+
+    if (file->minhash == NULL)
+    {
+	file->minhash = (u_int64_t *)malloc(sizeof(u_int64_t) * LSH_BINS);
+	memset(file->minhash, 0xff, sizeof(u_int64_t) * LSH_BINS);
+    }
+    if (v < file->minhash[bin])
+	file->minhash[bin] = v;
+}
+
+static int bucketcmp(const void *a, const void *b)
+/* order bands by key */
+{
+    const struct bucket_t *s = a, *t = b;
+
+    if (s->key != t->key)
+	return((s->key < t->key) ? -1 : 1);
+    return(0);
+}
+
+int lsh_filter(struct filehdr_t *files, struct sorthash_t *obarray, int count)
+/* drop the shreds of files no other tree resembles; return the new count */
+{
+    int		rows = LSH_BINS / lsh_bands, nfiles, nbuckets, i, j, k;
+    struct filehdr_t	*fp;
+    struct bucket_t	*buckets;
+    struct sorthash_t	*np, *tp;
+
+    nfiles = 0;
+    for (fp = files; fp->next; fp = fp->next)
+	if (fp->minhash)
+	    nfiles++;
+    buckets = (struct bucket_t *)malloc(sizeof(struct bucket_t) * nfiles * lsh_bands);
+
+    /* a band's key mixes its bins with its number */
+    nbuckets = 0;
+    for (fp = files; fp->next; fp = fp->next)
+	if (fp->minhash)
+	    for (i = 0; i < lsh_bands; i++)
+	    {
+		u_int64_t	key = i, *band = fp->minhash + i * rows;
+		bool		empty = true;
+
+		for (j = 0; j < rows; j++)
+		{
+		    empty &= (band[j] == LSH_EMPTY);
+		    key = (key ^ band[j]) * 0x9e3779b97f4a7c15ULL;
+		    key ^= key >> 29;
+		}
+		/* small files leave bins empty; that's no resemblance */
+		if (empty)
+		    continue;
+		buckets[nbuckets].key = key;
+		buckets[nbuckets].file = fp;
+		nbuckets++;
+	    }
+    qsort(buckets, nbuckets, sizeof(struct bucket_t), bucketcmp);
+
+    /* mark the files of every bucket holding more than one tree */
+    for (i = 0; i < nbuckets; i = j)
+    {
+	bool	mixed = false, wanted = !candidates || buckets[i].file->candidate;
+
+	for (j = i + 1; j < nbuckets && buckets[j].key == buckets[i].key; j++)
+	{
+	    if (!sametree(buckets[j].file->name, buckets[i].file->name))
+		mixed = true;
+	    if (buckets[j].file->candidate)
+		wanted = true;
+	}
+	if (mixed && wanted)
+	    for (k = i; k < j; k++)
+		buckets[k].file->alike = true;
+    }
+    free(buckets);
+
+    for (tp = np = obarray; np < obarray + count; np++)
+	if (np->file->alike)
+	    *tp++ = *np;
+    COUNT(dropped_lsh, np - tp);
+
+    if (verbose)
+    {
+	int	kept = 0;
+
+	for (fp = files; fp->next; fp = fp->next)
+	    if (fp->alike)
+		kept++;
+	fprintf(stderr, "%% LSH kept %d of %d files, %ld of %d shreds.\n",
+		kept, nfiles, (long)(tp - obarray), count);
+    }
+    for (fp = files; fp->next; fp = fp->next)
+    {
+	free(fp->minhash);
+	fp->minhash = NULL;
+    }
+    return(tp - obarray);
+}
+
+/* lsh.c ends here */
@@ -4,22 +4,31 @@
  * SPDX-License-Identifier: BSD-2-clause
  */
 
-#include <limits.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
-#ifdef __sun
-#include <alloca.h>
-#endif
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <errno.h>
+#include <limits.h>
 #include <time.h>
 #include <stdbool.h>
+#include <getopt.h>
 #include "shred.h"
 
 int verbose, debug, minsize, nofilter;
+int candidates;			/* inputs named with -C */
+static int binary_report;
+static bool hash_order;		/* write SCFs with shreds in hash order */
+static char *lookup;		/* snippet for --lookup, "-" for stdin */
+#define LOOKUP_TREE	"lookup"	/* the tree it is reported as */
+static int treefd = AT_FDCWD;	/* trees are looked up relative to this */
 
 struct scf_t
 {
@@ -29,26 +38,61 @@ struct scf_t
     u_int32_t	totallines;
     char	*normalization;
     int		shred_size;
+    int		winnow;		/* window of winnowing, 0 if none */
     char	*hash_method;
     char	*generator_program;
+    bool	hash_order;	/* shreds stored in hash order */
+    struct filehdr_t **files;	/* file table of a hash-ordered SCF */
+    linecount_t	nfiles, unread;
+    struct sorthash_t head;	/* next shred while merging */
+    struct sketch_t *sketch;	/* what hashes this input might hold */
+    long	data;		/* offset of the data section */
+    bool	candidate;	/* named with -C */
+    bool	scratch;	/* made from a tree, already counted */
+    struct fence_t *fences;	/* index of a hash-ordered SCF, for --lookup */
+    u_int32_t	nfences, stride;
+    long	trailer;	/* offset of the trailer, if indexed */
     struct scf_t *next;
 };
 static struct scf_t dummy_scf, *scflist = &dummy_scf;
 
 static struct filehdr_t dummy_filehdr, *filelist = &dummy_filehdr;
+static u_int32_t nregistered;	/* files registered so far */
 
-static int chunk_count, sort_count, dofilter;
-static size_t chunk_buffer_alloc_sz;
-static struct hash_t *chunk_buffer;
+static int sort_count, dofilter;
+static int nnormalizations;	/* -c writes an SCF for each of these */
 static size_t sort_buffer_alloc_sz;
 static struct sorthash_t *sort_buffer;
 
+static bool in_tree(const char *file, const char *tree)
+/* is this file listed under the given tree? */
+{
+    size_t	n = strlen(tree);
+
+    return(!strncmp(file, tree, n) && file[n] == '/');
+}
+
+static bool from_candidate(const char *file)
+/* is this file in the tree of a -C input? */
+{
+    struct scf_t	*scf;
+
+    for (scf = scflist; scf->next; scf = scf->next)
+	if (scf->candidate && in_tree(file, scf->name))
+	    return(true);
+    return(false);
+}
+
 struct filehdr_t *register_file(const char *file, linenum_t length)
 /* register a file and its line count into the in-core list */
 {
     struct filehdr_t	*new = (struct filehdr_t *)malloc(sizeof(struct filehdr_t));
     new->name = strdup(file);
     new->length = length;
+    new->minhash = NULL;
+    new->alike = false;
+    new->candidate = candidates && from_candidate(file);
+    new->serial = nregistered++;
     new->next = filelist;
     filelist = new;
     return(new);
@@ -71,26 +115,6 @@ static bool is_scf_file(const char *file)
     return(strncmp(buf, "#SCF-A ", 7) == 0);
 }
 
-/* 
- * We differentiate these two functions in order to avoid the memory
- * overhead of the extra (char *) when assembling shred lists to be written
- * to a file.  This is only worth bothering with because the data sets
- * can get quite large.
- */
-
-static void filehook(struct hash_t hash, struct filehdr_t *file)
-/* hook to store only hashes */
-{
-    if (chunk_buffer_alloc_sz < chunk_count + 1) {
-	chunk_buffer_alloc_sz = 2*chunk_buffer_alloc_sz + 1;
-	chunk_buffer = (struct hash_t *)realloc(chunk_buffer, 
-			  sizeof(struct hash_t) * (chunk_buffer_alloc_sz));
-    }
-
-    chunk_buffer[chunk_count++] = hash;
-}
-
-
 void corehook(struct hash_t hash, struct filehdr_t *file)
 /* hook to store hash and file */
 {
@@ -98,6 +122,7 @@ void corehook(struct hash_t hash, struct filehdr_t *file)
 	sort_buffer_alloc_sz = 2*sort_buffer_alloc_sz + 1;
 	sort_buffer = (struct sorthash_t *)realloc(sort_buffer, 
 			  sizeof(struct sorthash_t) * (sort_buffer_alloc_sz));
+	COUNT(reallocs, 1);
     }
     
     sort_buffer[sort_count].hash = hash;
@@ -105,337 +130,1815 @@ void corehook(struct hash_t hash, struct filehdr_t *file)
     sort_count++;
 }
 
-void extend_current_chunk(linenum_t linenumber)
-/* set the end-line number on the last chunk, if there is one */
+/*
+ * State of a tree being shredded.  The shredding pipeline hands each
+ * file's hashes to one of the consumers below, always in file-list
+ * order and always in the thread that called shred_files().  Several
+ * trees may be in progress at once when -c is building SCFs.
+ */
+struct tree_t
+{
+    const char	*name;
+    FILE	*fp;		/* where SCF file sections go */
+    int		files_seen, files_kept, chunks;
+    int		total;		/* files in the list */
+    linecount_t	lines;
+    bool	quiet;		/* stderr is shared with other trees */
+    struct indexhash_t *shreds;	/* held back to be written in hash order */
+    int		nshreds, shreds_alloc;
+    linenum_t	*lengths;	/* file lengths, to size their shreds */
+    int		lengths_alloc;
+    hashval_t	*hashes;	/* otherwise just the hashes, for the sketch */
+    int		nhashes, hashes_alloc;
+    struct fence_t *fences;	/* index of the hash-ordered shreds */
+    int		nfences;
+    struct scf_t *scf;		/* input a tree is being merged as */
+};
+
+struct indexhash_t	/* a shred and the index of its file in the SCF */
+{
+    struct hash_t	hash;
+    u_int32_t		file;
+};
+
+/*
+ * Hash-ordered SCFs carry a sparse index of their shreds: the hash and
+ * offset of every INDEX_STRIDEth record.  A hash is found by a binary
+ * search of the index and a scan of at most a stride of records, so
+ * --lookup never reads a corpus SCF whole.
+ */
+#define INDEX_STRIDE	64
+
+struct fence_t		/* one entry of the index */
+{
+    hashval_t	hash;
+    u_int64_t	offset;		/* from the first shred record */
+};
+
+static void progress_tick(struct tree_t *tp)
+/* update the percent-done display */
+{
+    progress_advance(PHASE_SHRED, 1);
+    if (tp->files_seen++ % 100 == 0 && percent_display() && !tp->quiet)
+	fprintf(stderr, "\b\b\b\b%3.0f%%", 
+		tp->files_seen / (tp->total * 0.01));
+}
+
+static void put_linenum(linenum_t n, bool wide, FILE *fp)
+/* write a line number or count at the width of its file */
 {
-    if (sort_count > 0)
-	sort_buffer[sort_count-1].hash.end = linenumber;
-    if (chunk_count > 0)
-	chunk_buffer[chunk_count-1].end = linenumber;
+    if (wide)
+    {
+	u_int32_t	net = htonl(n);
+
+	fwrite(&net, sizeof(u_int32_t), 1, fp);
+    }
+    else
+    {
+	u_int16_t	net = htons(n);
+
+	fwrite(&net, sizeof(u_int16_t), 1, fp);
+    }
 }
 
-static void write_scf(const char *tree, FILE *ofp)
-/* generate shred file for given tree */
+static bool put_length(linenum_t lines, FILE *fp)
+/* write a file's line count; return true if its numbers must be wide */
 {
-    char	**place, **list;
-    int		file_count, progress, totalchunks;
-    linecount_t	netfile_count, totallines = 0;
-    char	buf[BUFSIZ];
+    bool	wide = lines > NARROW_MAX;
 
-    if (verbose)
-	fprintf(stderr, "%% Scanning tree %s...", tree);
-    list = sorted_file_list(tree, &file_count);
-    if (!file_count)
+    if (wide)
+	put_linenum(WIDE_ESCAPE, false, fp);
+    put_linenum(lines, wide, fp);
+    return(wide);
+}
+
+static inline bool get_linenum(linenum_t *np, bool wide, FILE *fp)
+/* read a line number or count at the width of its file */
+{
+    if (wide)
     {
-	fprintf(stderr, 
-		"comparator: couldn't open %s, %s\n", tree, strerror(errno));
-	exit(1);
+	u_int32_t	net;
+
+	if (fread(&net, sizeof(u_int32_t), 1, fp) != 1)
+	    return(false);
+	*np = ntohl(net);
+    }
+    else
+    {
+	u_int16_t	net;
+
+	if (fread(&net, sizeof(u_int16_t), 1, fp) != 1)
+	    return(false);
+	*np = ntohs(net);
+    }
+    return(true);
+}
+
+static bool get_length(linenum_t *np, bool *widep, FILE *fp)
+/* read a file's line count and whether its numbers are wide */
+{
+    if (!get_linenum(np, false, fp))
+	return(false);
+    *widep = (*np == WIDE_ESCAPE);
+    return(!*widep || get_linenum(np, true, fp));
+}
+
+static void scf_file(struct tree_t *tp, const char *name, int shredded,
+		     struct chunklist_t *out)
+/* write the section for one file to the SCF of one normalization */
+{
+    linenum_t	lines;
+    struct hash_t	*np;
+    bool	wide;
+
+    lines = shredded;
+    tp->files_kept++;
+
+    /* the actual output */
+    phase_begin(PHASE_SCF_WRITE);
+    fputs(name, tp->fp);
+    fputc('\n', tp->fp);
+    tp->lines += lines;
+    wide = put_length(lines, tp->fp);
+    if (!hash_order)
+	put_linenum(out->count, wide, tp->fp);
+    else
+    {
+	if (tp->files_kept > tp->lengths_alloc)
+	{
+	    tp->lengths_alloc = 2 * tp->lengths_alloc + 64;
+	    tp->lengths = (linenum_t *)realloc(tp->lengths,
+			sizeof(linenum_t) * tp->lengths_alloc);
+	}
+	tp->lengths[tp->files_kept - 1] = lines;
+    }
+    if (hash_order && tp->nshreds + out->count > tp->shreds_alloc)
+    {
+	tp->shreds_alloc = 2 * tp->shreds_alloc + out->count;
+	tp->shreds = (struct indexhash_t *)realloc(tp->shreds,
+			sizeof(struct indexhash_t) * tp->shreds_alloc);
+	COUNT(reallocs, 1);
+    }
+    if (!hash_order && tp->nhashes + out->count > tp->hashes_alloc)
+    {
+	tp->hashes_alloc = 2 * tp->hashes_alloc + out->count;
+	tp->hashes = (hashval_t *)realloc(tp->hashes,
+			sizeof(hashval_t) * tp->hashes_alloc);
+	COUNT(reallocs, 1);
+    }
+    if (debug)
+	fprintf(stderr, "Chunks for %s:\n", name);
+    for (np = out->chunks; np < out->chunks + out->count; np++)
+    {
+	struct hash_t	this = np[0];
+
+	if (debug)
+	{
+	    fprintf(stderr,
+		    "%ld: %s %s:%d:%d",
+		    np-out->chunks, hash_dump(this.hash),
+		    name, this.start, this.end);
+	    if (np->flags)
+	    {
+		fputc('\t', stderr);
+		dump_flags(np->flags, stderr);
+		fprintf(stderr, " (0x%02x)", np->flags);
+	    }
+	    fputc('\n', stderr);
+	}
+	if (hash_order)
+	{
+	    tp->shreds[tp->nshreds].hash = this;
+	    tp->shreds[tp->nshreds].file = tp->files_kept - 1;
+	    tp->nshreds++;
+	    continue;
+	}
+	memcpy(&tp->hashes[tp->nhashes++], &this.hash, sizeof(hashval_t));
+	put_linenum(this.start, wide, tp->fp);
+	put_linenum(this.end,   wide, tp->fp);
+	fwrite(&this.hash,  sizeof(hashval_t), 1, tp->fp);
+	fwrite(&this.flags, sizeof(flag_t), 1, tp->fp);
+    }
+    phase_end(PHASE_SCF_WRITE);
+    tp->chunks += out->count;
+}
+
+static void scf_section(void *arg, const char *name, int shredded,
+			struct chunklist_t *out)
+/* write the SCF sections for one file, one per normalization */
+{
+    struct tree_t	*trees = (struct tree_t *)arg;
+    int		i;
+
+    progress_tick(trees);
+    if (shredded < 0)
+	return;
+    COUNT(files, 1);
+    COUNT(lines, shredded);
+    for (i = 0; i < nnormalizations; i++)
+	scf_file(trees + i, name, shredded, out + i);
+}
+
+static int indexcmp(const void *a, const void *b)
+/* order shreds by hash, then file, then line */
+{
+    const struct indexhash_t *s = a, *t = b;
+    int cmp = hash_compare(s->hash.hash, t->hash.hash);
+
+    if (cmp)
+	return(cmp);
+    else if (s->file != t->file)
+	return((s->file < t->file) ? -1 : 1);
+    else if (s->hash.start != t->hash.start)
+	return((s->hash.start < t->hash.start) ? -1 : 1);
+    else if (s->hash.end != t->hash.end)
+	return((s->hash.end < t->hash.end) ? -1 : 1);
+    else
+	return(0);
+}
+
+static void write_shreds(struct tree_t *tp, FILE *ofp)
+/* write a tree's shreds after its file table, in hash order */
+{
+    struct indexhash_t	*ip;
+    u_int32_t	count = htonl(tp->nshreds);
+    u_int64_t	offset = 0;
+
+    phase_begin(PHASE_SORT);
+    qsort(tp->shreds, tp->nshreds, sizeof(struct indexhash_t), indexcmp);
+    phase_end(PHASE_SORT);
+    phase_begin(PHASE_SCF_WRITE);
+    fwrite(&count, sizeof(u_int32_t), 1, ofp);
+    tp->fences = (struct fence_t *)malloc(sizeof(struct fence_t) * (tp->nshreds / INDEX_STRIDE + 1));
+    tp->nfences = 0;
+    for (ip = tp->shreds; ip < tp->shreds + tp->nshreds; ip++)
+    {
+	u_int32_t	file = htonl(ip->file);
+	bool		wide = tp->lengths[ip->file] > NARROW_MAX;
+
+	if ((ip - tp->shreds) % INDEX_STRIDE == 0)
+	{
+	    memcpy(&tp->fences[tp->nfences].hash, &ip->hash.hash, sizeof(hashval_t));
+	    tp->fences[tp->nfences++].offset = offset;
+	}
+	offset += sizeof(u_int32_t) + sizeof(hashval_t) + sizeof(flag_t)
+	    + 2 * (wide ? sizeof(u_int32_t) : sizeof(u_int16_t));
+	fwrite(&file,  sizeof(u_int32_t), 1, ofp);
+	put_linenum(ip->hash.start, wide, ofp);
+	put_linenum(ip->hash.end,   wide, ofp);
+	fwrite(&ip->hash.hash,  sizeof(hashval_t), 1, ofp);
+	fwrite(&ip->hash.flags, sizeof(flag_t), 1, ofp);
+    }
+    phase_end(PHASE_SCF_WRITE);
+}
+
+static void write_index(struct tree_t *tp, FILE *ofp)
+/* write the index of a hash-ordered SCF, after the trailer */
+{
+    struct fence_t	*fp;
+    u_int32_t	stride = htonl(INDEX_STRIDE), count = htonl(tp->nfences);
+
+    phase_begin(PHASE_SCF_WRITE);
+    for (fp = tp->fences; fp < tp->fences + tp->nfences; fp++)
+    {
+	u_int32_t	high = htonl(fp->offset >> 32), low = htonl(fp->offset);
+
+	fwrite(&fp->hash, sizeof(hashval_t), 1, ofp);
+	fwrite(&high, sizeof(u_int32_t), 1, ofp);
+	fwrite(&low, sizeof(u_int32_t), 1, ofp);
     }
+    fwrite(&stride, sizeof(u_int32_t), 1, ofp);
+    fwrite(&count, sizeof(u_int32_t), 1, ofp);
+    phase_end(PHASE_SCF_WRITE);
+    free(tp->fences);
+}
+
+static void write_sketch(struct tree_t *tp, FILE *ofp)
+/* append the sketch of a tree's hashes, after the trailer */
+{
+    struct sketch_t	*sp = sketch_new(tp->chunks);
+    int		i;
+
+    for (i = 0; i < tp->nshreds; i++)
+	sketch_add(sp, &tp->shreds[i].hash.hash);
+    for (i = 0; i < tp->nhashes; i++)
+	sketch_add(sp, tp->hashes + i);
+    phase_begin(PHASE_SCF_WRITE);
+    sketch_write(sp, ofp);
+    phase_end(PHASE_SCF_WRITE);
+    sketch_free(sp);
+    free(tp->shreds);
+    free(tp->lengths);
+    free(tp->hashes);
+}
+
+static void scf_header(const char *tree, FILE *ofp)
+/* write the metadata of an SCF under the current normalization */
+{
+    char	buf[BUFSIZ];
 
     fputs("#SCF-A 2.0\n", ofp);
     fputs("Generator-Program: comparator 1.0\n", ofp);
     fputs("Hash-Method: " HASHMETHOD "\n", ofp);
+    if (hash_order)
+	fputs("Index: fence\n", ofp);
     linebyline.dumpopt(buf);
     fprintf(ofp, "Normalization: %s\n", buf);
+    if (hash_order)
+	fputs("Order: hash\n", ofp);
     fprintf(ofp, "Root: %s\n", tree);
     fprintf(ofp, "Shred-Size: %d\n", shredsize);
+    fputs("Sketch: bloom\n", ofp);
+    if (winnow > 1)
+	fprintf(ofp, "Winnow: %d\n", winnow);
     fputs("%%\n", ofp);
+}
 
-    netfile_count = htonl(file_count);
-    fwrite(&netfile_count, sizeof(linecount_t), 1, ofp);
-    if (verbose)
-	fprintf(stderr, "reading %d files...    ", file_count);
-    progress = totalchunks = 0;
-    for (place = list; place < list + file_count; place++)
+/*
+ * With -c, each tree named on the command line gets its own SCF.  The
+ * trees are walked one after another and their files shredded as one
+ * list, so the threads of -j are shared by all of them rather than
+ * started over for each; a tree's SCFs are opened when its first file
+ * comes out of the pipeline and finished after its last.
+ */
+struct compile_t
+{
+    char	*tree;
+    char	**scf_out;	/* one per normalization, NULL if already open */
+    char	**list;		/* the tree's files */
+    int		nfiles, done;
+    char	*root;
+    FILE	**ofps;		/* one per normalization */
+    struct tree_t *trees;	/* likewise */
+    long	*countpos;	/* where each file count goes */
+    bool	quiet;
+};
+static struct compile_t *compiles;
+static int ncompiles, next_compile;
+
+static void scan_tree(struct compile_t *cp)
+/* list the files of a tree to be compiled */
+{
+    if (verbose && !cp->quiet)
+	fprintf(stderr, "%% Scanning tree %s...", cp->tree);
+    phase_begin(PHASE_WALK);
+    cp->list = sorted_file_list(treefd, cp->tree, &cp->nfiles);
+    phase_end(PHASE_WALK);
+    if (!cp->nfiles)
     {
-	linenum_t	net_chunks, lines;
-	struct hash_t	*np;
-	struct filehdr_t	*filep;
-
-	/* shredfile adds data to chunk_buffer */
-	chunk_buffer = (struct hash_t *)calloc(sizeof(struct hash_t), 1);
-	chunk_count = 0;
-	filep = register_file(*place, 0);
-	lines = shredfile(filep, filehook);
-	filep->length = lines;
-
-	/* the actual output */
-	fputs(*place, ofp);
-	fputc('\n', ofp);
-	totallines += lines;
-	lines = TONET(lines);
-	fwrite((char *)&lines, sizeof(linenum_t), 1, ofp);
-	net_chunks = TONET(chunk_count);
-	fwrite((char *)&net_chunks, sizeof(linenum_t), 1, ofp);
-	if (debug)
-	    fprintf(stderr, "Chunks for %s:\n", *place);
-	for (np = chunk_buffer; np < chunk_buffer + chunk_count; np++)
-	{
-	    struct hash_t	this = np[0];
+	fprintf(stderr, 
+		"comparator: couldn't open %s, %s\n", cp->tree, strerror(errno));
+	exit(1);
+    }
+    cp->root = tree_name(treefd, cp->tree);
+    progress_expect(PHASE_SHRED, cp->nfiles);
+}
+
+static void begin_scf(struct compile_t *cp)
+/* open a tree's SCFs and write what goes before the file sections */
+{
+    struct tree_t	*tp;
+    linecount_t	netfile_count;
+    int		i;
 
-	    if (debug)
+    if (cp->ofps == NULL)
+    {
+	cp->ofps = (FILE **)malloc(sizeof(FILE *) * nnormalizations);
+	for (i = 0; i < nnormalizations; i++)
+	    if ((cp->ofps[i] = fopen(cp->scf_out[i], "w")) == NULL)
 	    {
-		fprintf(stderr,
-			"%ld: %s %s:%d:%d",
-			np-chunk_buffer, hash_dump(this.hash),
-		       *place, this.start, this.end);
-		if (np->flags)
-		{
-		    fputc('\t', stderr);
-		    dump_flags(np->flags, stderr);
-		    fprintf(stderr, " (0x%02x)", np->flags);
-		}
-		fputc('\n', stderr);
+		perror("comparator");
+		exit(1);
 	    }
-	    this.start = TONET(this.start);
-	    this.end   = TONET(this.end);
-	    fwrite(&this.start, sizeof(linenum_t), 1, ofp);
-	    fwrite(&this.end,   sizeof(linenum_t), 1, ofp);
-	    fwrite(&this.hash,  sizeof(hashval_t), 1, ofp);
-	    fwrite(&this.flags, sizeof(flag_t), 1, ofp);
-	}
-	totalchunks += chunk_count;
-	free(chunk_buffer);
-	chunk_buffer_alloc_sz = 0;
-	if (verbose && !debug && progress++ % 100 == 0)
-	    fprintf(stderr, "\b\b\b\b%3.0f%%", progress / (file_count * 0.01));
     }
-    if (verbose)
-	fprintf(stderr, "\b\b\b\b100%%, done, %d total chunks.\n",totalchunks);
 
-    /* the statistics trailer */
-    totallines = htonl(totallines);
-    fwrite(&totallines, sizeof(linecount_t), 1, ofp);
+    /*
+     * Files whose names don't tell us whether they're text aren't
+     * sniffed until they're shredded, so the count of files in the
+     * section isn't known yet.  Leave a hole for it and fill it in at
+     * the end; if the output can't seek, spool the file sections.
+     */
+    cp->trees = (struct tree_t *)calloc(sizeof(struct tree_t), nnormalizations);
+    cp->countpos = (long *)malloc(sizeof(long) * nnormalizations);
+    for (i = 0; i < nnormalizations; i++)
+    {
+	tp = cp->trees + i;
+	linebyline.select(i);
+	scf_header(cp->root, cp->ofps[i]);
+	netfile_count = 0;
+	if ((cp->countpos[i] = ftell(cp->ofps[i])) != -1)
+	{
+	    tp->fp = cp->ofps[i];
+	    fwrite(&netfile_count, sizeof(linecount_t), 1, cp->ofps[i]);
+	}
+	else if ((tp->fp = tmpfile()) == NULL)
+	{
+	    perror("comparator: can't create spool file");
+	    exit(1);
+	}
+	tp->name = cp->root;
+	tp->total = cp->nfiles;
+	tp->quiet = cp->quiet;
+    }
+    if (verbose && !cp->quiet)
+    {
+	fprintf(stderr, "reading %d files...", cp->nfiles);
+	percent_begin();
+    }
 }
 
-static void read_scf(struct scf_t *scf)
-/* merge hashes from specified files into an in-code list */
+static void end_scf(struct compile_t *cp)
+/* fill in a tree's file counts and write what follows the sections */
 {
-    linecount_t	filecount;
-    int hashcount = 0;
-    struct stat sb;
+    struct tree_t	*tp;
+    char	**place, buf[BUFSIZ];
+    linecount_t	netfile_count, totallines;
+    int		i;
 
-    stat(scf->file, &sb);
-    if (verbose)
-	fprintf(stderr, "%% Reading hash list %s...    ", scf->file);
-    if (fread(&filecount, sizeof(linecount_t), 1, scf->fp) != 1) 
+    tarball_release(cp->root);
+    if (verbose && !cp->quiet)
     {
-	(void)fputs("comparator: fread() failed!\n", stderr);
+	percent_done();
+	fprintf(stderr, ", done, %d total chunks.\n", cp->trees[0].chunks);
     }
-    filecount = ntohl(filecount);
-    while (filecount--)
+    else if (verbose)
+	fprintf(stderr, "%% Tree %s done, %d files, %d total chunks.\n",
+		cp->tree, cp->trees[0].files_kept, cp->trees[0].chunks);
+
+    for (i = 0; i < nnormalizations; i++)
     {
-	char	buf[BUFSIZ];
-	linenum_t	lines, chunks;
-	struct filehdr_t	*filehdr;
+	FILE	*ofp = cp->ofps[i];
 
-	if (fgets(buf, sizeof(buf), scf->fp) == NULL)
+	tp = cp->trees + i;
+	netfile_count = htonl(tp->files_kept);
+	if (tp->fp == ofp)
 	{
-	    (void)fputs("comparator: fgets() failed!\n", stderr);
+	    fseek(ofp, cp->countpos[i], SEEK_SET);
+	    fwrite(&netfile_count, sizeof(linecount_t), 1, ofp);
+	    fseek(ofp, 0, SEEK_END);
 	}
-	*strchr(buf, '\n') = '\0';
-
-	if (fread(&lines, sizeof(linenum_t), 1, scf->fp) != 1)
+	else
 	{
-	    (void)fputs("comparator: fread() failed!\n", stderr);
-	}
-	lines = FROMNET(lines);
-	filehdr = register_file(buf, lines);
+	    size_t	n;
 
-	if (fread(&chunks, sizeof(linenum_t), 1, scf->fp) != 1)
-	{
-	    (void)fputs("comparator: fread() failed!\n", stderr);
+	    fwrite(&netfile_count, sizeof(linecount_t), 1, ofp);
+	    rewind(tp->fp);
+	    while ((n = fread(buf, 1, sizeof(buf), tp->fp)) > 0)
+		fwrite(buf, 1, n, ofp);
+	    fclose(tp->fp);
 	}
-	chunks = FROMNET(chunks);
-	while (chunks--)
-	{
-	    struct hash_t	this;
 
-	    if (fread(&this.start, sizeof(linenum_t), 1, scf->fp) != 1
-		|| fread(&this.end,  sizeof(linenum_t), 1, scf->fp) != 1
-		|| fread(&this.hash, sizeof(hashval_t), 1, scf->fp) != 1
-		|| fread(&this.flags, sizeof(flag_t), 1, scf->fp) != 1)
-	    {
-		(void)fputs("comparator: fread() failed!\n", stderr);
-	    }
-	    this.start = FROMNET(this.start);
-	    this.end = FROMNET(this.end);
-	    corehook(this, filehdr);
-	    hashcount++;
-	    if (verbose && !debug && hashcount % 10000 == 0)
-		fprintf(stderr,"\b\b\b\b%3.0f%%",(ftell(scf->fp) / (sb.st_size * 0.01)));
-	}
+	if (hash_order)
+	    write_shreds(tp, ofp);
+
+	/* the statistics trailer */
+	totallines = htonl(tp->lines);
+	fwrite(&totallines, sizeof(linecount_t), 1, ofp);
+	if (hash_order)
+	    write_index(tp, ofp);
+	write_sketch(tp, ofp);
+	if (cp->scf_out)
+	    fclose(ofp);
     }
-    if (verbose)
-	fprintf(stderr, "\b\b\b\b100%%...done, %d shreds\n", hashcount);
+    if (cp->scf_out)
+	free(cp->ofps);
+    free(cp->trees);
+    free(cp->countpos);
+    free(cp->root);
+    for (place = cp->list; place < cp->list + cp->nfiles; place++)
+	free(*place);
+    free(cp->list);
+}
 
-    if (fread(&scf->totallines, sizeof(linecount_t), 1, scf->fp) != 1)
+static void write_scf(const char *tree, FILE **ofps, bool quiet)
+/* generate shred files for given tree, one per normalization */
+{
+    struct compile_t	c;
+
+    memset(&c, 0, sizeof(c));
+    c.tree = (char *)tree;
+    c.ofps = ofps;
+    c.quiet = quiet;
+    scan_tree(&c);
+    begin_scf(&c);
+    shred_files(treefd, c.list, c.nfiles, nnormalizations, scf_section, c.trees);
+    end_scf(&c);
+}
+
+static void compile_section(void *arg, const char *name, int shredded,
+			    struct chunklist_t *out)
+/* pass a file's shreds to the SCFs of the tree it came from */
+{
+    struct compile_t	*cp = compiles + next_compile;
+
+    if (cp->done++ == 0)
+	begin_scf(cp);
+    scf_section(cp->trees, name, shredded, out);
+    if (cp->done == cp->nfiles)
     {
-	(void)fputs("comparator: fread() failed!\n", stderr);
+	end_scf(cp);
+	next_compile++;
     }
-    scf->totallines = ntohl(scf->totallines);
 }
 
-static int merge_tree(char *tree)
-/* add to the in-core list of sorthash structures from a tree */
+static char *scf_name(const char *tree, int n)
+/* name the SCF of a tree under the nth normalization */
 {
-    char	**place, **list;
-    int	old_entry_count, file_count, i;
-    linecount_t	totallines = 0;
+    char	buf[BUFSIZ], tag[8], *cp, *name, *root = tree_name(treefd, tree);
+    int		len = 0;
 
-    old_entry_count = sort_count;
-    file_count = 0;
-    if (verbose)
-	fprintf(stderr, "%% Scanning tree %s...", tree);
-    list = sorted_file_list(tree, &file_count);
-    if (!file_count)
+    if (nnormalizations == 1)
+	strcpy(tag, "");
+    else
     {
-	fprintf(stderr, 
-		"comparator: couldn't open %s, %s\n", tree, strerror(errno));
-	exit(1);
+	/* initials of the normalization steps, as in foo-wcb.scf */
+	linebyline.select(n);
+	linebyline.dumpopt(buf);
+	tag[len++] = '-';
+	for (cp = strstr(buf, "remove-"); cp; cp = strstr(cp + 1, "remove-"))
+	    tag[len++] = cp[strlen("remove-")];
+	tag[len] = '\0';
+	if (len == 1)
+	    strcpy(tag, "-plain");
     }
-    i = 0;
-    if (verbose)
-	fprintf(stderr, "reading %d files...    ", file_count);
-    for (place = list; place < list + file_count; place++)
-    {
-	struct filehdr_t *filep = register_file(*place, 0);
-	linenum_t lines = shredfile(filep, corehook);
+    name = malloc(strlen(root) + strlen(tag) + 5);
+    strcpy(name, root);
+    strcat(name, tag);
+    strcat(name, ".scf");
+    free(root);
+    return(name);
+}
+
+static void compile_trees(void)
+/* build the queued SCFs, shredding all their files as one list */
+{
+    char	**list;
+    int		i, total = 0;
 
-	filep->length = lines; 
-	totallines += lines;
-	if (verbose && !debug && !(i++ % 100))
-	    fprintf(stderr, "\b\b\b\b%3.0f%%", i / (file_count * 0.01));
+    for (i = 0; i < ncompiles; i++)
+    {
+	compiles[i].quiet = (ncompiles > 1);
+	scan_tree(compiles + i);
+	total += compiles[i].nfiles;
     }
-    if (verbose)
-	fprintf(stderr, "\b\b\b\b100%%...done, %d files, %d shreds.\n", 
-		file_count, sort_count - old_entry_count);
+    list = (char **)malloc(sizeof(char *) * (total + 1));
+    for (total = i = 0; i < ncompiles; i++)
+    {
+	memcpy(list + total, compiles[i].list,
+	       sizeof(char *) * compiles[i].nfiles);
+	total += compiles[i].nfiles;
+    }
+    next_compile = 0;
+    shred_files(treefd, list, total, nnormalizations, compile_section, NULL);
     free(list);
-    return(totallines);
 }
 
-static void init_scf(char *file, struct scf_t *scf, const int readfile)
-/* add to the in-core list of sorthash structures from a SCF file */
+static void read_file_table(struct scf_t *scf)
+/* read the file table and shred count of a hash-ordered SCF */
 {
-    scf->file = strdup(file);
-    if (readfile)
+    linecount_t	i;
+
+    if (fread(&scf->nfiles, sizeof(linecount_t), 1, scf->fp) != 1) 
+    {
+	(void)fputs("comparator: fread() failed!\n", stderr);
+    }
+    scf->nfiles = ntohl(scf->nfiles);
+    scf->files = (struct filehdr_t **)malloc(sizeof(struct filehdr_t *) * (scf->nfiles + 1));
+    for (i = 0; i < scf->nfiles; i++)
     {
 	char	buf[BUFSIZ];
+	linenum_t	lines;
+	bool	wide;
 
-	/* read in the SCF metadata block and add it to the in-core list */
-	scf->fp   = fopen(scf->file, "r");
-	if (!scf->fp)
-	{
-	    (void)fprintf(stderr, 
-			  "comparator: file %s, %s", 
-			  scf->file, strerror(errno));
-	    exit(1);
-	}
 	if (fgets(buf, sizeof(buf), scf->fp) == NULL)
 	{
-	    (void)fputs("comparator: frgets() failed!\n", stderr);
-	}
-	if (strncmp(buf, "#SCF-A 2.0", 9))
-	{
-	    fprintf(stderr, 
-		    "comparator: %s is not a SCF-A file.\n", 
-		    scf->file);
+	    (void)fputs("comparator: fgets() failed!\n", stderr);
 	    exit(1);
 	}
-	while (fgets(buf, sizeof(buf), scf->fp) != NULL)
+	*strchr(buf, '\n') = '\0';
+
+	if (!get_length(&lines, &wide, scf->fp))
 	{
-	    char	*value;
+	    (void)fputs("comparator: fread() failed!\n", stderr);
+	}
+	scf->files[i] = register_file(buf, lines);
+    }
+    if (fread(&scf->unread, sizeof(linecount_t), 1, scf->fp) != 1) 
+    {
+	(void)fputs("comparator: fread() failed!\n", stderr);
+    }
+    scf->unread = ntohl(scf->unread);
+}
+
+static bool read_shred(struct scf_t *scf, struct sorthash_t *sp)
+/* read the next shred of a hash-ordered SCF */
+{
+    u_int32_t	file;
+    bool	ok = false;
+
+    if (scf->unread == 0)
+	return(false);
+    scf->unread--;
+    if (fread(&file, sizeof(u_int32_t), 1, scf->fp) == 1
+	&& (file = ntohl(file)) < scf->nfiles)
+    {
+	/* the width of the line numbers is that of the shred's file */
+	bool	wide = scf->files[file]->length > NARROW_MAX;
+
+	ok = get_linenum(&sp->hash.start, wide, scf->fp)
+	    && get_linenum(&sp->hash.end, wide, scf->fp)
+	    && fread(&sp->hash.hash, sizeof(hashval_t), 1, scf->fp) == 1
+	    && fread(&sp->hash.flags, sizeof(flag_t), 1, scf->fp) == 1;
+    }
+    if (!ok)
+    {
+	fprintf(stderr, "comparator: %s is truncated or corrupt.\n", scf->file);
+	exit(1);
+    }
+    sp->file = scf->files[file];
+    if (!scf->scratch)
+	COUNT(shreds_loaded, 1);
+    return(true);
+}
+
+static void read_trailer(struct scf_t *scf)
+/* read the statistics trailer of an SCF */
+{
+    if (fread(&scf->totallines, sizeof(linecount_t), 1, scf->fp) != 1)
+    {
+	(void)fputs("comparator: fread() failed!\n", stderr);
+    }
+    scf->totallines = ntohl(scf->totallines);
+    if (!scf->scratch)
+	COUNT(lines, scf->totallines);
+}
+
+/*
+ * Most shreds match nothing.  If every other input carries a sketch of
+ * its hashes, a shred none of them can hold would only end up in a
+ * clique confined to its own tree, which the comparison throws away;
+ * so it needn't be loaded at all.  With -C only cliques holding a
+ * candidate are kept, so a corpus shred need only be looked for in the
+ * candidates' sketches.
+ */
+static bool counterpart(struct scf_t *self, struct scf_t *other)
+/* could a shred of self be kept for matching one of other? */
+{
+    return other != self && (!candidates || self->candidate || other->candidate);
+}
+
+static bool sketchable(struct scf_t *self)
+/* do all the inputs this one can match have sketches? */
+{
+    struct scf_t	*scf;
+
+    for (scf = scflist; scf->next; scf = scf->next)
+	if (counterpart(self, scf) && !scf->sketch)
+	    return(false);
+    return(true);
+}
+
+static bool sketched_out(struct scf_t *self, const hashval_t *hp)
+/* is this hash certainly absent from every input it can match? */
+{
+    struct scf_t	*scf;
+
+    for (scf = scflist; scf->next; scf = scf->next)
+	if (counterpart(self, scf) && sketch_test(scf->sketch, hp))
+	    return(false);
+    COUNT(dropped_sketch, 1);
+    return(true);
+}
+
+/*
+ * With -P the comparison is split among worker processes, each owning
+ * a slice of hash space.  Equal hashes land in the same slice, so every
+ * clique is found whole by one worker.
+ */
+static int nshards, shard;	/* how many workers, and which one this is */
+
+static inline bool in_slice(const hashval_t *hp)
+/* does this hash fall in the slice this process owns? */
+{
+    return(nshards == 0
+	   || (((hash_mix(hp) & 0xffffffff) * nshards) >> 32) == shard);
+}
+
+static inline void read_chunk(struct scf_t *scf, struct filehdr_t *filehdr,
+			      bool wide, bool filter, int *countp)
+/* read one shred of a file section and hand it to the core */
+{
+    struct hash_t	this;
+
+    if (!get_linenum(&this.start, wide, scf->fp)
+	|| !get_linenum(&this.end, wide, scf->fp)
+	|| fread(&this.hash, sizeof(hashval_t), 1, scf->fp) != 1
+	|| fread(&this.flags, sizeof(flag_t), 1, scf->fp) != 1)
+    {
+	(void)fputs("comparator: fread() failed!\n", stderr);
+    }
+    if (!scf->scratch)
+	COUNT(shreds_loaded, 1);
+    /* signatures are of whole files, so every -P worker gets the same */
+    if (lsh_bands)
+	lsh_add(filehdr, &this.hash);
+    if (!in_slice(&this.hash))
+	return;
+    if (filter && sketched_out(scf, &this.hash))
+	return;
+    corehook(this, filehdr);
+    (*countp)++;
+}
+
+static void read_progress(struct scf_t *scf, off_t *markp, off_t size,
+			  bool force)
+/* account for the SCF bytes read since the last call, or all at the end */
+{
+    off_t	here = force ? size : ftell(scf->fp);
+
+    /* a megabyte at a time, so small file sections don't cost a write each */
+    if (!force && here - *markp < 1 << 20)
+	return;
+    if (!scf->scratch)
+	COUNT(bytes_read, here - *markp);
+    progress_advance(PHASE_SCF_READ, here - *markp);
+    *markp = here;
+    if (percent_display() && !force)
+	fprintf(stderr, "\b\b\b\b%3.0f%%", here / (size * 0.01));
+}
+
+static void read_scf(struct scf_t *scf)
+/* merge hashes from specified files into an in-code list */
+{
+    bool	filter = sketchable(scf);
+    linecount_t	filecount;
+    int hashcount = 0, records = 0;
+    struct stat sb;
+    off_t	mark;
+
+    stat(scf->file, &sb);
+    if (verbose)
+    {
+	fprintf(stderr, "%% Reading hash list %s...", scf->file);
+	percent_begin();
+    }
+    phase_begin(PHASE_SCF_READ);
+    mark = ftell(scf->fp);
+    progress_expect(PHASE_SCF_READ, sb.st_size - mark);
+    if (scf->hash_order)
+    {
+	struct sorthash_t	this;
+
+	read_file_table(scf);
+	while (read_shred(scf, &this))
+	{
+	    if (++records % 10000 == 0)
+		read_progress(scf, &mark, sb.st_size, false);
+	    if (lsh_bands)
+		lsh_add(this.file, &this.hash.hash);
+	    if (!in_slice(&this.hash.hash))
+		continue;
+	    if (filter && sketched_out(scf, &this.hash.hash))
+		continue;
+	    corehook(this.hash, this.file);
+	    hashcount++;
+	}
+	filecount = 0;
+    }
+    else if (fread(&filecount, sizeof(linecount_t), 1, scf->fp) != 1) 
+    {
+	(void)fputs("comparator: fread() failed!\n", stderr);
+    }
+    filecount = ntohl(filecount);
+    while (filecount--)
+    {
+	char	buf[BUFSIZ];
+	linenum_t	lines = 0, chunks = 0;
+	struct filehdr_t	*filehdr;
+	bool	wide;
+
+	if (fgets(buf, sizeof(buf), scf->fp) == NULL)
+	{
+	    (void)fputs("comparator: fgets() failed!\n", stderr);
+	}
+	*strchr(buf, '\n') = '\0';
+
+	if (!get_length(&lines, &wide, scf->fp))
+	{
+	    (void)fputs("comparator: fread() failed!\n", stderr);
+	}
+	filehdr = register_file(buf, lines);
+
+	if (!get_linenum(&chunks, wide, scf->fp))
+	{
+	    (void)fputs("comparator: fread() failed!\n", stderr);
+	}
+	/* one loop per width, so neither tests it per shred */
+	if (wide)
+	    while (chunks--)
+		read_chunk(scf, filehdr, true, filter, &hashcount);
+	else
+	    while (chunks--)
+		read_chunk(scf, filehdr, false, filter, &hashcount);
+	read_progress(scf, &mark, sb.st_size, false);
+    }
+    if (verbose)
+    {
+	percent_done();
+	fprintf(stderr, "...done, %d shreds\n", hashcount);
+    }
+
+    read_trailer(scf);
+    read_progress(scf, &mark, sb.st_size, true);
+    phase_end(PHASE_SCF_READ);
+}
+
+/*
+ * When every input is a hash-ordered SCF, the shreds are merged from
+ * all of them at once through a heap keyed on each one's next shred,
+ * and fed to the comparison in the order sort_hashes() would give.
+ */
+static struct scf_t **heap;
+static int nheap;
+
+static void sift_down(int i)
+/* restore the heap property below slot i */
+{
+    for (;;)
+    {
+	struct scf_t *swap;
+	int least = i, child;
+
+	for (child = 2*i + 1; child <= 2*i + 2 && child < nheap; child++)
+	    if (shred_order(&heap[child]->head, &heap[least]->head) < 0)
+		least = child;
+	if (least == i)
+	    break;
+	swap = heap[i];
+	heap[i] = heap[least];
+	heap[least] = swap;
+	i = least;
+    }
+}
+
+static bool next_shred(struct sorthash_t *sp)
+/* deliver the least shred among all the SCFs being merged */
+{
+    static u_int64_t	unreported;	/* shreds merged since the last advance */
+    struct scf_t *top;
+
+    if (nheap == 0)
+    {
+	progress_advance(PHASE_MERGE, unreported);
+	unreported = 0;
+	return(false);
+    }
+    if (++unreported == 65536)
+    {
+	progress_advance(PHASE_MERGE, unreported);
+	unreported = 0;
+    }
+    top = heap[0];
+    *sp = top->head;
+    if (!read_shred(top, &top->head))
+	heap[0] = heap[--nheap];
+    sift_down(0);
+    return(true);
+}
+
+static void merge_file(void *arg, const char *name, int shredded,
+		       struct chunklist_t *out)
+/* add one file's hashes to the in-core list */
+{
+    struct tree_t	*tp = (struct tree_t *)arg;
+    struct filehdr_t	*filep;
+    struct hash_t	*np;
+    bool	filter = sketchable(tp->scf);
+
+    progress_tick(tp);
+    if (shredded < 0)
+	return;
+    filep = register_file(name, shredded);
+    for (np = out->chunks; np < out->chunks + out->count; np++)
+    {
+	/* signatures cover every shred, not just those the sketches pass */
+	if (lsh_bands)
+	    lsh_add(filep, &np->hash);
+	if (!filter || !sketched_out(tp->scf, &np->hash))
+	    corehook(*np, filep);
+    }
+    tp->lines += shredded;
+    tp->files_kept++;
+    COUNT(files, 1);
+    COUNT(lines, shredded);
+}
+
+static void sketch_input(struct scf_t *scf, int from)
+/* sketch the shreds an input added, from the given one on */
+{
+    int	i;
+
+    /* later inputs can be tested against what this one holds */
+    scf->sketch = sketch_new(sort_count - from);
+    for (i = from; i < sort_count; i++)
+	sketch_add(scf->sketch, &sort_buffer[i].hash.hash);
+}
+
+static int merge_tree(struct scf_t *scf)
+/* add to the in-core list of sorthash structures from a tree */
+{
+    struct tree_t	t;
+    char	*tree = scf->file, **place, **list;
+    int	old_entry_count, file_count;
+
+    old_entry_count = sort_count;
+    file_count = 0;
+    if (verbose)
+	fprintf(stderr, "%% Scanning tree %s...", tree);
+    phase_begin(PHASE_WALK);
+    list = sorted_file_list(treefd, tree, &file_count);
+    phase_end(PHASE_WALK);
+    if (!file_count)
+    {
+	fprintf(stderr, 
+		"comparator: couldn't open %s, %s\n", tree, strerror(errno));
+	exit(1);
+    }
+    if (verbose)
+    {
+	fprintf(stderr, "reading %d files...", file_count);
+	percent_begin();
+    }
+    t.name = tree;
+    t.fp = NULL;
+    t.total = file_count;
+    t.files_seen = t.files_kept = t.chunks = 0;
+    t.lines = 0;
+    t.quiet = false;
+    t.scf = scf;
+    progress_expect(PHASE_SHRED, file_count);
+    shred_files(treefd, list, file_count, 1, merge_file, &t);
+    tarball_release(scf->name);
+    if (verbose)
+    {
+	percent_done();
+	fprintf(stderr, "...done, %d files, %d shreds.\n",
+		t.files_kept, sort_count - old_entry_count);
+    }
+
+    sketch_input(scf, old_entry_count);
+    for (place = list; place < list + file_count; place++)
+	free(*place);
+    free(list);
+    return(t.lines);
+}
+
+static char *snippet_name;	/* what the --lookup snippet is called */
+static hashval_t *queries;	/* its distinct hashes, in order */
+static int nqueries;
+
+static void snippet_file(void *arg, const char *name, int shredded,
+			 struct chunklist_t *out)
+/* add the snippet's hashes under its name in the report */
+{
+    merge_file(arg, snippet_name, shredded, out);
+}
+
+static int querycmp(const void *a, const void *b)
+/* order hashes as they are in a hash-ordered SCF */
+{
+    return(hash_compare(*(const hashval_t *)a, *(const hashval_t *)b));
+}
+
+static int shred_snippet(struct scf_t *scf, const char *file)
+/* shred the --lookup snippet, a file or stdin, as the corpus was */
+{
+    struct tree_t	t;
+    struct source_t	src;
+    int		i, n, old_entry_count = sort_count;
+
+    /*
+     * The snippet is shredded whatever its name, since the user chose
+     * it; the tests that keep junk out of trees don't apply.
+     */
+    if (!strcmp(file, "-"))
+    {
+	size_t	alloc = BUFSIZ;
+	ssize_t	got;
+
+	memset(&src, '\0', sizeof(src));
+	if ((src.base = malloc(alloc)) == NULL)
+	{
+	    fputs("comparator: out of memory reading stdin\n", stderr);
+	    exit(1);
+	}
+	while ((got = read(STDIN_FILENO, src.base + src.size,
+			   alloc - src.size)) != 0)
+	{
+	    if (got < 0)
+	    {
+		perror("comparator: can't read stdin");
+		exit(1);
+	    }
+	    if ((src.size += got) == alloc
+		&& (src.base = realloc(src.base, alloc *= 2)) == NULL)
+	    {
+		fputs("comparator: out of memory reading stdin\n", stderr);
+		exit(1);
+	    }
+	}
+	COUNT(bytes_read, src.size);
+	file = "stdin";
+    }
+    else if (!source_open(&src, AT_FDCWD, file))
+    {
+	fprintf(stderr, "comparator: can't read %s, %s\n", file, strerror(errno));
+	exit(1);
+    }
+    snippet_name = (char *)malloc(strlen(scf->name) + strlen(file) + 2);
+    sprintf(snippet_name, "%s/%s", scf->name, file);
+
+    t.name = scf->name;
+    t.fp = NULL;
+    t.total = 1;
+    t.files_seen = t.files_kept = t.chunks = 0;
+    t.lines = 0;
+    t.quiet = true;
+    t.scf = scf;
+    progress_expect(PHASE_SHRED, 1);
+    shred_source(file, &src, 1, snippet_file, &t);
+    if (t.files_kept == 0)
+    {
+	fprintf(stderr, "comparator: nothing to look up in %s.\n", file);
+	exit(1);
+    }
+    sketch_input(scf, old_entry_count);
+
+    /* shreds no SCF's sketch holds were dropped, so needn't be sought */
+    nqueries = sort_count - old_entry_count;
+    queries = (hashval_t *)malloc(sizeof(hashval_t) * (nqueries + 1));
+    for (i = 0; i < nqueries; i++)
+	memcpy(queries + i, &sort_buffer[old_entry_count + i].hash.hash, sizeof(hashval_t));
+    qsort(queries, nqueries, sizeof(hashval_t), querycmp);
+    for (i = 0, n = nqueries, nqueries = 0; i < n; i++)
+	if (nqueries == 0 || hash_compare(queries[i], queries[nqueries - 1]))
+	    memcpy(queries + nqueries++, queries + i, sizeof(hashval_t));
+    return(t.lines);
+}
+
+static bool read_fences(struct scf_t *scf, u_int32_t count)
+/* read count index entries at the current position */
+{
+    u_int32_t	i, high, low;
+
+    scf->fences = (struct fence_t *)malloc(sizeof(struct fence_t) * (count + 1));
+    for (i = 0; i < count; i++)
+    {
+	if (fread(&scf->fences[i].hash, sizeof(hashval_t), 1, scf->fp) != 1
+	    || fread(&high, sizeof(u_int32_t), 1, scf->fp) != 1
+	    || fread(&low, sizeof(u_int32_t), 1, scf->fp) != 1)
+	{
+	    free(scf->fences);
+	    scf->fences = NULL;
+	    return(false);
+	}
+	scf->fences[i].offset = ((u_int64_t)ntohl(high) << 32) | ntohl(low);
+    }
+    return(true);
+}
+
+static void read_index(struct scf_t *scf)
+/* read the index between the trailer and the sketch of an SCF */
+{
+    const long	entry = sizeof(hashval_t) + 2 * sizeof(u_int32_t);
+    long	here = ftell(scf->fp), end;
+    u_int32_t	stride, count;
+    struct stat	sb;
+
+    if (fstat(fileno(scf->fp), &sb) != 0)
+	return;
+    end = sb.st_size;
+    if (scf->sketch)
+	end -= SKETCH_BYTES(scf->sketch) + 2 * sizeof(u_int32_t);
+    if (fseek(scf->fp, end - 2 * (long)sizeof(u_int32_t), SEEK_SET) == 0
+	&& fread(&stride, sizeof(u_int32_t), 1, scf->fp) == 1
+	&& fread(&count, sizeof(u_int32_t), 1, scf->fp) == 1
+	&& (stride = ntohl(stride)) > 0)
+    {
+	count = ntohl(count);
+	scf->trailer = end - 2 * sizeof(u_int32_t) - count * entry - sizeof(linecount_t);
+	if (scf->trailer >= scf->data
+	    && fseek(scf->fp, scf->trailer + sizeof(linecount_t), SEEK_SET) == 0
+	    && read_fences(scf, count))
+	{
+	    scf->nfences = count;
+	    scf->stride = stride;
+	}
+    }
+    fseek(scf->fp, here, SEEK_SET);
+}
+
+static void lookup_scf(struct scf_t *scf)
+/* add the shreds of an indexed SCF that match the snippet */
+{
+    struct sorthash_t	this;
+    linecount_t	total;
+    long	base;
+    int		i, found = 0;
+
+    phase_begin(PHASE_SCF_READ);
+    read_file_table(scf);
+    total = scf->unread;
+    base = ftell(scf->fp);
+    for (i = 0; i < nqueries; i++)
+    {
+	int	lo = 0, hi = scf->nfences;
+
+	/* start at the last fence below the hash, as equal ones may straddle */
+	while (lo < hi)
+	{
+	    int	mid = (lo + hi) / 2;
+
+	    if (hash_compare(scf->fences[mid].hash, queries[i]) < 0)
+		lo = mid + 1;
+	    else
+		hi = mid;
+	}
+	if (lo > 0)
+	    lo--;
+	if (lo >= scf->nfences
+	    || fseek(scf->fp, base + scf->fences[lo].offset, SEEK_SET) != 0)
+	    continue;
+	scf->unread = total - lo * scf->stride;
+	while (read_shred(scf, &this))
+	{
+	    int	cmp = hash_compare(this.hash.hash, queries[i]);
+
+	    if (cmp > 0)
+		break;
+	    else if (cmp == 0)
+	    {
+		corehook(this.hash, this.file);
+		found++;
+	    }
+	}
+    }
+    fseek(scf->fp, scf->trailer, SEEK_SET);
+    read_trailer(scf);
+    phase_end(PHASE_SCF_READ);
+    if (verbose)
+	fprintf(stderr, "%% Looked up %d hashes in %s, %d shreds found.\n",
+		nqueries, scf->file, found);
+}
+
+static void init_scf(char *file, struct scf_t *scf, const int readfile)
+/* add to the in-core list of sorthash structures from a SCF file */
+{
+    scf->file = strdup(file);
+    if (readfile)
+    {
+	char	buf[BUFSIZ];
+	bool	indexed = false;
+
+	/* read in the SCF metadata block and add it to the in-core list */
+	scf->fp   = fopen(scf->file, "r");
+	if (!scf->fp)
+	{
+	    (void)fprintf(stderr, 
+			  "comparator: file %s, %s", 
+			  scf->file, strerror(errno));
+	    exit(1);
+	}
+	if (fgets(buf, sizeof(buf), scf->fp) == NULL)
+	{
+	    (void)fputs("comparator: frgets() failed!\n", stderr);
+	}
+	if (strncmp(buf, "#SCF-A 2.0", 9))
+	{
+	    fprintf(stderr, 
+		    "comparator: %s is not a SCF-A file.\n", 
+		    scf->file);
+	    exit(1);
+	}
+	while (fgets(buf, sizeof(buf), scf->fp) != NULL)
+	{
+	    char	*value;
+
+	    if (!strcmp(buf, "%%\n"))
+		break;
+	    value = strchr(buf, ':');
+	    *value++ = '\0';
+	    while(*value == ' ')
+		value++;
+	    strchr(value, '\n')[0] = '\0';
+
+	    if (!strcmp(buf, "Normalization"))
+		scf->normalization = strdup(value);
+	    else if (!strcmp(buf, "Shred-Size"))
+		scf->shred_size = atoi(value);
+	    else if (!strcmp(buf, "Winnow"))
+		scf->winnow = atoi(value);
+	    else if (!strcmp(buf, "Hash-Method"))
+		scf->hash_method = strdup(value);
+	    else if (!strcmp(buf, "Generator-Program"))
+		scf->generator_program = strdup(value);
+	    else if (!strcmp(buf, "Root"))
+		scf->name = strdup(value);
+	    else if (!strcmp(buf, "Order"))
+		scf->hash_order = !strcmp(value, "hash");
+	    else if (!strcmp(buf, "Sketch") && !strcmp(value, "bloom"))
+		scf->sketch = sketch_read(scf->fp);
+	    else if (!strcmp(buf, "Index"))
+		indexed = !strcmp(value, "fence");
+	}
+	scf->data = ftell(scf->fp);
+	if (lookup && scf->hash_order && indexed)
+	    read_index(scf);
+    }
+    else
+    {
+	char	buf[BUFSIZ];
+
+	scf->hash_method = HASHMETHOD;
+	linebyline.dumpopt(buf);
+	scf->normalization = strdup(buf);
+	scf->shred_size = shredsize;
+	scf->winnow = (winnow > 1) ? winnow : 0;
+	scf->generator_program = "comparator " VERSION;
+	scf->name = tree_name(treefd, file);
+    }
+}
+
+void dump_flags(const int flags, FILE *fp)
+/* dump tokens corresponding to a flag set */
+{
+    fputc(' ', fp);
+    if (flags & INSIGNIFICANT)
+	fputs(" insignificant", fp);
+    if (flags & C_CODE)
+	fputs(" C", fp);
+    if (flags & SHELL_CODE)
+	fputs(" shell", fp);
+}
+
+void dump_array(const char *legend, 
+		struct sorthash_t *obarray, int hashcount)
+/* dump the contents of a sort_hash array */
+{
+    struct sorthash_t	*np;
+
+    fputs(legend, stdout);
+    for (np = obarray; np < obarray + hashcount; np++)
+	if (!(np->hash.flags & INTERNAL_FLAG))
+	{
+	    fprintf(stdout, "%2ld: %s %s:%d:%d",
+		    np-obarray, 
+		    hash_dump(np->hash.hash),
+		    np->file->name, np->hash.start, np->hash.end);
+	    if (np->hash.flags)
+	    {
+		fputc('\t', stdout);
+		dump_flags(np->hash.flags, stdout);
+		fprintf(stdout, " (0x%02x)", np->hash.flags);
+	    }
+	    fputc('\n', stdout);
+	}
+}
+
+static long header_bytes;	/* report written ahead of the ranges */
+
+static void header(const char *fmt, ...)
+/* write a line of the report header, keeping count of its length */
+{
+    va_list	ap;
+    int		n;
+
+    va_start(ap, fmt);
+    n = vprintf(fmt, ap);
+    va_end(ap);
+    if (n > 0)
+	header_bytes += n;
+}
+
+void report_time(char *legend, ...)
+/* report on time since last report_mark */
+{
+    static u_int64_t mark_time;
+    u_int64_t endtime = monotonic_ns();
+    va_list	ap;
+
+    if (mark_time && verbose)
+    {
+	int hours, minutes;
+	double elapsed, seconds;
+	char	buf[BUFSIZ];
+
+	elapsed = (endtime - mark_time) / 1e9;
+	hours = elapsed / 3600; elapsed -= hours * 3600;
+	minutes = elapsed / 60; elapsed -= minutes * 60;
+	seconds = elapsed;
+
+	va_start(ap, legend);
+	vsnprintf(buf, sizeof(buf), legend, ap);
+	va_end(ap);
+	fprintf(stderr, "%% %s: %dh %dm %.6fs\n", buf, hours, minutes, seconds);
+    }
+    mark_time = endtime;
+}
+
+static void report_linecache(void)
+/* tell how much repeated lines saved the analyzer */
+{
+    u_int64_t	lookups = stats.linecache_hits + stats.linecache_misses;
+
+    if (verbose && lookups)
+	fprintf(stderr, "%% Line cache: %llu of %llu lines hit (%.1f%%)\n",
+		(unsigned long long)stats.linecache_hits,
+		(unsigned long long)lookups,
+		stats.linecache_hits * 100.0 / lookups);
+}
+
+static char *statsfile;
+
+static void dump_stats(void)
+/* write statistics on the way out, however we leave */
+{
+    write_stats(statsfile);
+}
+
+/*
+ * A worker sends the coordinator the file table (only worker 0 does),
+ * the line totals of the inputs, then the shreds of the cliques it
+ * kept in sort order, ended by a file index of END_OF_SHARD, and its
+ * run counters.  Both ends are the same binary on the same host, so
+ * everything goes in native form.
+ */
+#define END_OF_SHARD	((u_int32_t)-1)
+
+static FILE *worker_out;
+
+static void send_clique(struct sorthash_t *clique, int nmatches)
+/* pass one of a worker's cliques to the coordinator */
+{
+    int		i;
+
+    for (i = 0; i < nmatches; i++)
+    {
+	fwrite(&clique[i].file->serial, sizeof(u_int32_t), 1, worker_out);
+	fwrite(&clique[i].hash, sizeof(struct hash_t), 1, worker_out);
+    }
+}
+
+static void run_worker(int fd)
+/* read this worker's slice of every SCF and reduce it */
+{
+    struct scf_t	*scf;
+    struct filehdr_t	*fp, **files;
+    u_int32_t	n, i, end = END_OF_SHARD;
+
+    /* the SCF streams are shared with the other workers; open our own */
+    for (scf = scflist; scf->next; scf = scf->next)
+	if ((scf->fp = fopen(scf->file, "r")) == NULL
+	    || fseek(scf->fp, scf->data, SEEK_SET) != 0)
+	    _exit(1);
+    worker_out = fdopen(fd, "w");
+    if (shard)
+	verbose = 0;
+    memset(&stats, 0, sizeof(stats));	/* the parent's are its own */
+
+    for (scf = scflist; scf->next; scf = scf->next)
+    {
+	read_scf(scf);
+	fclose(scf->fp);
+    }
+
+    /* every worker registers the same files in the same order */
+    files = (struct filehdr_t **)malloc(sizeof(struct filehdr_t *) * (nregistered + 1));
+    for (fp = filelist; fp->next; fp = fp->next)
+	files[fp->serial] = fp;
+    n = (shard == 0) ? nregistered : 0;
+    fwrite(&n, sizeof(u_int32_t), 1, worker_out);
+    for (i = 0; i < n; i++)
+    {
+	u_int32_t	len = strlen(files[i]->name);
+
+	fwrite(&files[i]->length, sizeof(linenum_t), 1, worker_out);
+	fwrite(&len, sizeof(u_int32_t), 1, worker_out);
+	fwrite(files[i]->name, 1, len, worker_out);
+    }
+    for (scf = scflist; scf->next; scf = scf->next)
+	fwrite(&scf->totallines, sizeof(u_int32_t), 1, worker_out);
+
+    if (lsh_bands)
+	sort_count = lsh_filter(filelist, sort_buffer, sort_count);
+    phase_begin(PHASE_SORT);
+    sort_hashes(sort_buffer, sort_count);
+    phase_end(PHASE_SORT);
+    export_cliques(sort_buffer, sort_count, send_clique);
+    fwrite(&end, sizeof(u_int32_t), 1, worker_out);
+    fwrite(&stats, sizeof(struct stats_t), 1, worker_out);
+    _exit((fclose(worker_out) == 0) ? 0 : 1);
+}
+
+static FILE **workers;		/* result streams, in slice order */
+static pid_t *worker_pids;
+static struct sorthash_t *worker_heads;	/* next shred from each, if any */
+static bool *worker_done;
+static struct filehdr_t **shard_files;
+static u_int32_t nshard_files;
+
+static void worker_failed(int w)
+/* give up on a worker that didn't send everything */
+{
+    fprintf(stderr, "comparator: worker %d failed.\n", w);
+    exit(1);
+}
+
+static void read_worker_header(int w)
+/* read the file table and line totals that open a worker's results */
+{
+    FILE	*fp = workers[w];
+    struct scf_t	*scf;
+    u_int32_t	n, i;
+
+    if (fread(&n, sizeof(u_int32_t), 1, fp) != 1)
+	worker_failed(w);
+    if (n)
+    {
+	shard_files = (struct filehdr_t **)malloc(sizeof(struct filehdr_t *) * n);
+	nshard_files = n;
+    }
+    for (i = 0; i < n; i++)
+    {
+	char		buf[BUFSIZ];
+	linenum_t	length;
+	u_int32_t	len;
+
+	if (fread(&length, sizeof(linenum_t), 1, fp) != 1
+	    || fread(&len, sizeof(u_int32_t), 1, fp) != 1
+	    || len >= sizeof(buf)
+	    || fread(buf, 1, len, fp) != len)
+	    worker_failed(w);
+	buf[len] = '\0';
+	shard_files[i] = register_file(buf, length);
+    }
+    for (scf = scflist; scf->next; scf = scf->next)
+	if (fread(&scf->totallines, sizeof(u_int32_t), 1, fp) != 1)
+	    worker_failed(w);
+}
+
+static void advance_worker(int w)
+/* read a worker's next shred, or its counters if it has no more */
+{
+    FILE	*fp = workers[w];
+    u_int32_t	file;
+    struct stats_t	ws;
+    u_int64_t	*to = (u_int64_t *)&stats, *from = (u_int64_t *)&ws;
+    int		i;
+
+    if (fread(&file, sizeof(u_int32_t), 1, fp) != 1)
+	worker_failed(w);
+    if (file != END_OF_SHARD)
+    {
+	if (file >= nshard_files
+	    || fread(&worker_heads[w].hash, sizeof(struct hash_t), 1, fp) != 1)
+	    worker_failed(w);
+	worker_heads[w].file = shard_files[file];
+	return;
+    }
+
+    /* counters add up, but every worker reads all of every input */
+    if (fread(&ws, sizeof(struct stats_t), 1, fp) != 1)
+	worker_failed(w);
+    if (w > 0)
+	ws.files = ws.lines = ws.bytes_read = ws.shreds_loaded = 0;
+    for (i = 0; i < sizeof(struct stats_t) / sizeof(u_int64_t); i++)
+	to[i] += from[i];
+    fclose(fp);
+    worker_done[w] = true;
+}
+
+static bool next_from_workers(struct sorthash_t *sp)
+/* deliver the least shred the workers have sent */
+{
+    int		w, least = -1;
+
+    /*
+     * Slices share no hashes, so this only interleaves the workers'
+     * cliques; but the range merge has to see them in the same order
+     * a single process would.
+     */
+    for (w = 0; w < nshards; w++)
+	if (!worker_done[w]
+	    && (least == -1 || shred_order(&worker_heads[w], &worker_heads[least]) < 0))
+	    least = w;
+    if (least == -1)
+	return(false);
+    *sp = worker_heads[least];
+    advance_worker(least);
+    return(true);
+}
+
+static char **scratch_files;	/* SCFs made from trees for the workers */
+static int nscratch;
+static pid_t scratch_owner;
+
+static void remove_scratch(void)
+/* remove the scratch SCFs, however the coordinator leaves */
+{
+    if (getpid() == scratch_owner)
+	while (nscratch > 0)
+	    unlink(scratch_files[--nscratch]);
+}
+
+static void start_workers(struct scf_t **inputs, int ninputs)
+/* turn trees into scratch SCFs, then fork a worker per slice */
+{
+    int		i;
+
+    scratch_files = (char **)malloc(sizeof(char *) * ninputs);
+    scratch_owner = getpid();
+    atexit(remove_scratch);
+
+    /* shred trees just once, here, rather than once in every worker */
+    for (i = 0; i < ninputs; i++)
+	if (!inputs[i]->fp)
+	{
+	    char	*tmpdir = getenv("TMPDIR"), path[BUFSIZ];
+	    FILE	*ofp;
+	    int		fd;
+
+	    snprintf(path, sizeof(path), "%s/comparatorXXXXXX.scf",
+		     tmpdir ? tmpdir : "/tmp");
+	    if ((fd = mkstemps(path, strlen(".scf"))) == -1
+		|| (ofp = fdopen(fd, "w")) == NULL)
+	    {
+		fprintf(stderr, "comparator: can't create %s, %s\n",
+			path, strerror(errno));
+		exit(1);
+	    }
+	    scratch_files[nscratch++] = strdup(path);
+	    write_scf(inputs[i]->file, &ofp, false);
+	    fclose(ofp);
+	    init_scf(path, inputs[i], 1);
+	    /* the shredding above counted its lines and bytes already */
+	    inputs[i]->scratch = true;
+	}
+    report_linecache();
+
+    fflush(NULL);
+    workers = (FILE **)malloc(sizeof(FILE *) * nshards);
+    worker_pids = (pid_t *)malloc(sizeof(pid_t) * nshards);
+    for (shard = 0; shard < nshards; shard++)
+    {
+	int	fds[2];
+
+	if (pipe(fds) == -1 || (worker_pids[shard] = fork()) == -1)
+	{
+	    perror("comparator: can't start worker");
+	    exit(1);
+	}
+	if (worker_pids[shard] == 0)
+	{
+	    close(fds[0]);
+	    run_worker(fds[1]);
+	}
+	close(fds[1]);
+	workers[shard] = fdopen(fds[0], "r");
+    }
+    shard = 0;
+
+    worker_heads = (struct sorthash_t *)malloc(sizeof(struct sorthash_t) * nshards);
+    worker_done = (bool *)calloc(sizeof(bool), nshards);
+    for (i = 0; i < nshards; i++)
+	read_worker_header(i);
+    for (i = 0; i < nshards; i++)
+	advance_worker(i);
+}
+
+static void finish_workers(void)
+/* reap the workers and remove the scratch SCFs */
+{
+    int		i, status;
 
-	    if (!strcmp(buf, "%%\n"))
-		break;
-	    value = strchr(buf, ':');
-	    *value++ = '\0';
-	    while(*value == ' ')
-		value++;
-	    strchr(value, '\n')[0] = '\0';
+    for (i = 0; i < nshards; i++)
+	if (waitpid(worker_pids[i], &status, 0) == -1
+	    || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+	    worker_failed(i);
+    remove_scratch();
+}
 
-	    if (!strcmp(buf, "Normalization"))
-		scf->normalization = strdup(value);
-	    else if (!strcmp(buf, "Shred-Size"))
-		scf->shred_size = atoi(value);
-	    else if (!strcmp(buf, "Hash-Method"))
-		scf->hash_method = strdup(value);
-	    else if (!strcmp(buf, "Generator-Program"))
-		scf->generator_program = strdup(value);
-	    else if (!strcmp(buf, "Root"))
-		scf->name = strdup(value);
-	}
+/*
+ * A checkpoint holds the sorted, compacted shred list of a comparison
+ * and the file table it points into, so a run that dies in the range
+ * merge, or one that only wants different -m, -n or -b settings, can
+ * start again from the reduce phase.  After a short text header come
+ * the file table and the shreds as fixed-size records, aligned so the
+ * image can be mapped and converted in one pass.  Records are in the
+ * native layout of the build that wrote them; the header says how big
+ * they are so another build won't misread them.
+ */
+#define CHECKPOINT_ALIGN	8
+
+static void pad_to_align(FILE *fp)
+/* pad a checkpoint out to the next record boundary */
+{
+    while (ftell(fp) % CHECKPOINT_ALIGN)
+	fputc('\0', fp);
+}
+
+static void write_checkpoint(const char *file,
+			     struct sorthash_t *obarray, int hashcount)
+/* save the compacted shred list and the file table */
+{
+    FILE	*fp = fopen(file, "w");
+    struct scf_t	*scf;
+    struct filehdr_t	*hp, **files;
+    u_int64_t	count = hashcount;
+    u_int32_t	i;
+
+    if (!fp)
+    {
+	fprintf(stderr, "comparator: can't write %s, %s\n",
+		file, strerror(errno));
+	exit(1);
     }
-    else
+    fputs("#SCF-C 1.0\n", fp);
+    fprintf(fp, "Hash-Method: %s\n", scflist->hash_method);
+    fprintf(fp, "Normalization: %s\n", scflist->normalization);
+    fprintf(fp, "Shred-Size: %d\n", scflist->shred_size);
+    fprintf(fp, "Record-Size: %d\n", (int)sizeof(struct indexhash_t));
+    for (scf = scflist; scf->next; scf = scf->next)
+	fprintf(fp, "Input: %u %s\n", scf->totallines, scf->name);
+    fputs("%%\n", fp);
+
+    files = (struct filehdr_t **)malloc(sizeof(struct filehdr_t *) * (nregistered + 1));
+    for (hp = filelist; hp->next; hp = hp->next)
+	files[hp->serial] = hp;
+    pad_to_align(fp);
+    fwrite(&nregistered, sizeof(u_int32_t), 1, fp);
+    for (i = 0; i < nregistered; i++)
     {
-	char	buf[BUFSIZ];
+	u_int32_t	len = strlen(files[i]->name);
 
-	scf->hash_method = HASHMETHOD;
-	linebyline.dumpopt(buf);
-	scf->normalization = strdup(buf);
-	scf->shred_size = shredsize;
-	scf->generator_program = "comparator " VERSION;
-	scf->name = strdup(file);
+	fwrite(&files[i]->length, sizeof(linenum_t), 1, fp);
+	fwrite(&len, sizeof(u_int32_t), 1, fp);
+	fwrite(files[i]->name, 1, len, fp);
     }
+    free(files);
+
+    pad_to_align(fp);
+    fwrite(&count, sizeof(u_int64_t), 1, fp);
+    for (i = 0; i < hashcount; i++)
+    {
+	struct indexhash_t	rec;
+
+	memset(&rec, '\0', sizeof(rec));	/* no stray padding bytes */
+	rec.hash = obarray[i].hash;
+	rec.file = obarray[i].file->serial;
+	fwrite(&rec, sizeof(rec), 1, fp);
+    }
+    if (fclose(fp) != 0)
+    {
+	fprintf(stderr, "comparator: can't write %s, %s\n",
+		file, strerror(errno));
+	exit(1);
+    }
+    if (verbose)
+	fprintf(stderr, "%% Checkpoint of %d shreds written to %s\n",
+		hashcount, file);
 }
 
-void dump_flags(const int flags, FILE *fp)
-/* dump tokens corresponding to a flag set */
+static void bad_checkpoint(const char *file)
+/* complain about a checkpoint we can't use */
 {
-    fputc(' ', fp);
-    if (flags & INSIGNIFICANT)
-	fputs(" insignificant", fp);
-    if (flags & C_CODE)
-	fputs(" C", fp);
-    if (flags & SHELL_CODE)
-	fputs(" shell", fp);
+    fprintf(stderr, "comparator: %s is not a usable checkpoint.\n", file);
+    exit(1);
 }
 
-void dump_array(const char *legend, 
-		struct sorthash_t *obarray, int hashcount)
-/* dump the contents of a sort_hash array */
+static void read_checkpoint(const char *file)
+/* restore the inputs, files and shreds saved by write_checkpoint() */
 {
-    struct sorthash_t	*np;
-
-    fputs(legend, stdout);
-    for (np = obarray; np < obarray + hashcount; np++)
-	if (!(np->hash.flags & INTERNAL_FLAG))
+    FILE	*fp = fopen(file, "r");
+    char	buf[BUFSIZ], *normalization = NULL, *method = NULL;
+    char	*base, *cp, *end;
+    struct scf_t	**inputs = NULL;
+    struct filehdr_t	**files;
+    int		ninputs = 0, shred_size = 0, recsize = 0;
+    u_int32_t	nfiles, i;
+    u_int64_t	count;
+    struct stat	sb;
+
+    if (!fp || fgets(buf, sizeof(buf), fp) == NULL
+	|| strncmp(buf, "#SCF-C 1.0", 10))
+	bad_checkpoint(file);
+    while (fgets(buf, sizeof(buf), fp) != NULL && strcmp(buf, "%%\n"))
+    {
+	char	*value = strchr(buf, ':');
+
+	if (!value)
+	    bad_checkpoint(file);
+	*value++ = '\0';
+	value += strspn(value, " ");
+	value[strcspn(value, "\n")] = '\0';
+	if (!strcmp(buf, "Hash-Method"))
+	    method = strdup(value);
+	else if (!strcmp(buf, "Normalization"))
+	    normalization = strdup(value);
+	else if (!strcmp(buf, "Shred-Size"))
+	    shred_size = atoi(value);
+	else if (!strcmp(buf, "Record-Size"))
+	    recsize = atoi(value);
+	else if (!strcmp(buf, "Input"))
 	{
-	    fprintf(stdout, "%2ld: %s %s:%d:%d",
-		    np-obarray, 
-		    hash_dump(np->hash.hash),
-		    np->file->name, np->hash.start, np->hash.end);
-	    if (np->hash.flags)
-	    {
-		fputc('\t', stdout);
-		dump_flags(np->hash.flags, stdout);
-		fprintf(stdout, " (0x%02x)", np->hash.flags);
-	    }
-	    fputc('\n', stdout);
+	    struct scf_t *scf = (struct scf_t *)calloc(sizeof(struct scf_t), 1);
+	    char	*name = strchr(value, ' ');
+
+	    if (!name)
+		bad_checkpoint(file);
+	    scf->totallines = strtoul(value, NULL, 10);
+	    scf->name = strdup(name + 1);
+	    scf->file = scf->name;
+	    inputs = (struct scf_t **)realloc(inputs, sizeof(struct scf_t *) * (ninputs + 1));
+	    inputs[ninputs++] = scf;
 	}
-}
+    }
+    if (!method || !normalization || ninputs == 0)
+	bad_checkpoint(file);
+    if (recsize != sizeof(struct indexhash_t))
+    {
+	fprintf(stderr, "comparator: %s was made by a different build.\n", file);
+	exit(1);
+    }
 
-void report_time(char *legend, ...)
-/* report on time since last report_mark */
-{
-    static time_t mark_time;
-    time_t endtime = time(NULL);
-    va_list	ap;
+    /* they were written in list order, so link them back in reverse */
+    while (ninputs--)
+    {
+	struct scf_t	*scf = inputs[ninputs];
 
-    if (mark_time && verbose)
+	scf->hash_method = method;
+	scf->normalization = normalization;
+	scf->shred_size = shred_size;
+	scf->next = scflist;
+	scflist = scf;
+    }
+    free(inputs);
+
+    if (fstat(fileno(fp), &sb) != 0
+	|| (base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0)) == MAP_FAILED)
+	bad_checkpoint(file);
+    end = base + sb.st_size;
+    cp = base + ftell(fp);
+    cp += (CHECKPOINT_ALIGN - (cp - base) % CHECKPOINT_ALIGN) % CHECKPOINT_ALIGN;
+
+    if (cp + sizeof(u_int32_t) > end)
+	bad_checkpoint(file);
+    memcpy(&nfiles, cp, sizeof(u_int32_t));
+    cp += sizeof(u_int32_t);
+    files = (struct filehdr_t **)malloc(sizeof(struct filehdr_t *) * (nfiles + 1));
+    for (i = 0; i < nfiles; i++)
     {
-    	int elapsed, hours, minutes, seconds;
-	char	buf[BUFSIZ];
-	elapsed = endtime - mark_time;
-	hours = elapsed/3600; elapsed %= 3600;
-	minutes = elapsed/60; elapsed %= 60;
-	seconds = elapsed;
+	linenum_t	length;
+	u_int32_t	len;
+
+	if (cp + sizeof(linenum_t) + sizeof(u_int32_t) > end)
+	    bad_checkpoint(file);
+	memcpy(&length, cp, sizeof(linenum_t));
+	memcpy(&len, cp + sizeof(linenum_t), sizeof(u_int32_t));
+	cp += sizeof(linenum_t) + sizeof(u_int32_t);
+	if (len >= sizeof(buf) || cp + len > end)
+	    bad_checkpoint(file);
+	memcpy(buf, cp, len);
+	buf[len] = '\0';
+	cp += len;
+	files[i] = register_file(buf, length);
+    }
 
-	va_start(ap, legend);
-	vsprintf(buf, legend, ap);
-	fprintf(stderr, "%% %s: %dh %dm %ds\n", buf, hours, minutes, seconds);
+    cp += (CHECKPOINT_ALIGN - (cp - base) % CHECKPOINT_ALIGN) % CHECKPOINT_ALIGN;
+    if (cp + sizeof(u_int64_t) > end)
+	bad_checkpoint(file);
+    memcpy(&count, cp, sizeof(u_int64_t));
+    cp += sizeof(u_int64_t);
+    if (count > (end - cp) / sizeof(struct indexhash_t))
+	bad_checkpoint(file);
+
+    /* the records are aligned, so they can be read in place */
+    sort_buffer = (struct sorthash_t *)realloc(sort_buffer,
+			sizeof(struct sorthash_t) * (count + 1));
+    for (sort_count = 0; sort_count < count; sort_count++)
+    {
+	const struct indexhash_t *rec = (const struct indexhash_t *)cp + sort_count;
+
+	if (rec->file >= nfiles)
+	    bad_checkpoint(file);
+	sort_buffer[sort_count].hash = rec->hash;
+	sort_buffer[sort_count].file = files[rec->file];
     }
-    mark_time = endtime;
+    munmap(base, sb.st_size);
+    fclose(fp);
+    free(files);
+    if (verbose)
+	fprintf(stderr, "%% Resuming from %s with %d shreds\n", file, sort_count);
 }
 
 static FILE *redirect(const char *outfile)
@@ -453,18 +1956,50 @@ static FILE *redirect(const char *outfile)
     return(stdout);
 }
 
+static int count_arg(const char *arg, const char *option)
+/* parse the count given to an option; it has to be a whole number, 1 or more */
+{
+    char	*end;
+    long	n;
+
+    errno = 0;
+    n = strtol(arg, &end, 10);
+    if (end == arg || *end || errno || n < 1 || n > INT_MAX)
+    {
+	fprintf(stderr, "comparator: %s needs a whole number of 1 or more.\n",
+		option);
+	exit(1);
+    }
+    return(n);
+}
+
 static void usage(void)
 {
-    fprintf(stderr,"usage: comparator [-h] [-c] [-C] [-d dir ] [-m minsize] [-n] [-o file] [-s shredsize] [-v] [-x] path...\n");
+    fprintf(stderr,"usage: comparator [-h] [-b] [-c] [-C path] [-d dir ] [-j threads] [-m minsize] [-n] [-N spec] [-o file] [-P workers] [-s shredsize] [-v] [-w window] [-x] [--checkpoint=file] [--hash=method] [--lookup[=file]] [--lsh[=bands]] [--progress[=fd]] [--resume=file] [--sorted] [--stats=file] path...\n");
     fprintf(stderr,"  -h      = print this help\n");
+    fprintf(stderr,"  -b      = emit the binary encoding of the SCF-B report\n");
     fprintf(stderr,"  -c      = generate SCF files\n");
-    fprintf(stderr,"  -d dir  = change directory before digesting.\n");
+    fprintf(stderr,"  -C path = compare this tree or SCF against the others only.\n");
+    fprintf(stderr,"  -d dir  = look for trees in dir.\n");
+    fprintf(stderr,"  -j n    = shred with n threads in all (default one per CPU).\n");
     fprintf(stderr,"  -m size = set minimum size of span to be output.\n");
     fprintf(stderr,"  -n      = suppress significance filtering.\n");
+    fprintf(stderr,"  -N spec = set normalization; repeat with -c for an SCF of each.\n");
     fprintf(stderr,"  -o file = write to the specified file.\n");
+    fprintf(stderr,"  -P n    = compare in n worker processes, each with a slice of hashes.\n");
     fprintf(stderr,"  -s size = set shred size (default %d)\n", shredsize);
+    fprintf(stderr,"  --hash=method = hash with RXOR or MD5 (default from the first SCF).\n");
+    fprintf(stderr,"  --checkpoint=file = save the sorted shreds for --resume.\n");
+    fprintf(stderr,"  --lookup[=file] = find a snippet (default stdin) in the SCFs.\n");
+    fprintf(stderr,"  --lsh[=bands] = compare only files LSH finds alike across trees.\n");
+    fprintf(stderr,"  --progress[=fd] = report throughput and ETAs, as JSON if to fd.\n");
+    fprintf(stderr,"  --resume=file = report from a checkpoint instead of inputs.\n");
+    fprintf(stderr,"  --sorted = write SCF shreds in hash order, for merging.\n");
+    fprintf(stderr,"  --stats=file = write phase timings and counters as JSON.\n");
     fprintf(stderr,"  -v      = enable progress messages on stderr.\n");
+    fprintf(stderr,"  -w n    = keep only the least shred of every n (winnowing).\n");
     fprintf(stderr,"  -x      = debug, display chunks in output.\n");
+    fprintf(stderr,"Each path is a tree, an SCF, or a .tar archive (- reads one from stdin).\n");
     fprintf(stderr,"This is comparator version " VERSION ".\n");
     exit(0);
 }
@@ -475,24 +2010,56 @@ main(int argc, char *argv[])
     extern char	*optarg;	/* set by getopt */
     extern int	optind;		/* set by getopt */
 
-    int status, file_only, compile_only, argcount, mergecount;
-    struct scf_t	*scf;
-    char *dir, *outfile, *normalization = "line-oriented";
+    static struct option longopts[] = {
+	{"checkpoint", required_argument, NULL, 'K'},
+	{"hash", required_argument, NULL, 'M'},
+	{"lookup", optional_argument, NULL, 'F'},
+	{"lsh", optional_argument, NULL, 'L'},
+	{"progress", optional_argument, NULL, 'G'},
+	{"resume", required_argument, NULL, 'R'},
+	{"sorted", no_argument, NULL, 'H'},
+	{"stats", required_argument, NULL, 'S'},
+	{NULL, 0, NULL, 0},
+    };
+    int status, file_only, compile_only, argcount, mergecount, i, j;
+    int progress = -1;
+    bool streaming, json_progress = false;
+    struct scf_t	*scf, **inputs;
+    char *dir, *outfile, *checkpoint, *resume, **normalizations, **probes;
 
     compile_only = file_only = nofilter = 0;
-    dir = outfile = NULL;
-    while ((status = getopt(argc, argv, "cd:hm:nN:o:s:vx")) != EOF)
+    dir = outfile = checkpoint = resume = NULL;
+    normalizations = (char **)malloc(sizeof(char *) * argc);
+    probes = (char **)malloc(sizeof(char *) * argc);
+    while ((status = getopt_long(argc, argv, "bcC:d:hj:m:nN:o:P:s:vw:x",
+			       longopts, NULL)) != EOF)
     {
 	switch (status)
 	{
+	case 'b':
+	    binary_report = 1;
+	    break;
+
 	case 'c':
 	    compile_only = 1;
 	    break;
 
+	case 'C':
+	    /* its files are listed as tree/file, whatever way it was typed */
+	    probes[candidates] = strdup(optarg);
+	    for (i = strlen(optarg); i > 1 && optarg[i - 1] == '/'; i--)
+		probes[candidates][i - 1] = '\0';
+	    candidates++;
+	    break;
+
 	case 'd':
 	    dir = optarg;
 	    break;
 
+	case 'j':
+	    shred_threads = atoi(optarg);
+	    break;
+
 	case 'm':
 	    minsize = atoi(optarg);
 	    break;
@@ -502,7 +2069,7 @@ main(int argc, char *argv[])
 	    break;
 
 	case 'N':
-	    normalization = strdup(optarg);
+	    normalizations[nnormalizations++] = strdup(optarg);
 	    break;
 
 	case 'o':
@@ -513,10 +2080,68 @@ main(int argc, char *argv[])
 	    shredsize = atoi(optarg);
 	    break;
 
+	case 'H':
+	    hash_order = true;
+	    break;
+
+	case 'K':
+	    checkpoint = optarg;
+	    break;
+
+	case 'F':
+	    lookup = optarg ? optarg : "-";
+	    break;
+
+	case 'L':
+	    lsh_bands = optarg ? atoi(optarg) : 32;
+	    if (lsh_bands <= 0 || lsh_bands > 32 || 32 % lsh_bands)
+	    {
+		fputs("comparator: --lsh bands must divide 32.\n", stderr);
+		exit(1);
+	    }
+	    break;
+
+	case 'G':
+	    progress = optarg ? atoi(optarg) : STDERR_FILENO;
+	    if (progress < 0 || (optarg && fcntl(progress, F_GETFD) == -1))
+	    {
+		fprintf(stderr, "comparator: --progress needs an open descriptor.\n");
+		exit(1);
+	    }
+	    json_progress = (optarg != NULL);
+	    break;
+
+	case 'P':
+	    nshards = count_arg(optarg, "-P");
+	    break;
+
+	case 'R':
+	    resume = optarg;
+	    break;
+
+	case 'M':
+	    /* the engine for the method was chosen before we got here */
+	    if (strcasecmp(optarg, HASHMETHOD))
+	    {
+		fprintf(stderr, "comparator: no hash method %s.\n", optarg);
+		exit(1);
+	    }
+	    break;
+
+	case 'S':
+	    if (statsfile == NULL)
+		atexit(dump_stats);
+	    statsfile = optarg;
+	    break;
+
 	case 'v':
 	    verbose = 1;
 	    break;
 
+	case 'w':
+	    winnow = count_arg(optarg, "-w");
+	    break;
+
 	case 'x':
 	    debug = 1;
 	    break;
@@ -533,122 +2158,210 @@ main(int argc, char *argv[])
 	sort_count = 0;
     }
 
-    argcount = (argc - optind);
-    if (argcount == 0)
+    argcount = (argc - optind) + candidates;
+    if (lookup)
+    {
+	/* the snippet goes in as the one candidate */
+	for (i = optind; i < argc; i++)
+	    if (!is_scf_file(argv[i]))
+		break;
+	if (argcount == 0 || i < argc || candidates || compile_only
+	    || nshards || lsh_bands || checkpoint || resume)
+	{
+	    fputs("comparator: --lookup takes only SCFs, and none of -c, -C, -P, --lsh,\n"
+		  "--checkpoint or --resume.\n", stderr);
+	    exit(1);
+	}
+	probes[candidates++] = LOOKUP_TREE;
+	argcount++;
+    }
+    if (candidates && (compile_only || argcount == candidates))
+    {
+	fputs("comparator: -C needs other inputs to compare with, and no -c.\n",
+	      stderr);
+	exit(1);
+    }
+    if (nshards && (checkpoint || resume))
+    {
+	fputs("comparator: -P can't be used with --checkpoint or --resume.\n",
+	      stderr);
+	exit(1);
+    }
+    if (checkpoint && !resume && (compile_only || argcount == 1))
+    {
+	fputs("comparator: --checkpoint needs a comparison, not -c or a single tree.\n",
+	      stderr);
+	exit(1);
+    }
+    if (resume)
+    {
+	/* the checkpoint stands in for all the inputs */
+	if (argcount || compile_only || checkpoint)
+	{
+	    fputs("comparator: --resume takes no inputs and no -c or --checkpoint.\n",
+		  stderr);
+	    exit(1);
+	}
+	read_checkpoint(resume);
+    }
+    else if (argcount == 0)
 	usage();
 
     report_time(NULL);
+    if (progress >= 0)
+	progress_start(progress, json_progress);
+
+    /* a snippet is shredded the way the first SCF was */
+    if (lookup)
+    {
+	struct scf_t	first;
+
+	memset(&first, '\0', sizeof(first));
+	init_scf(argv[optind], &first, 1);
+	if (nnormalizations == 0)
+	    normalizations[nnormalizations++] = first.normalization;
+	shredsize = first.shred_size;
+	winnow = first.winnow;
+	fclose(first.fp);
+	if (first.sketch)
+	    sketch_free(first.sketch);
+    }
 
     /*
      * Check each normalizer to see if it fires.
      */
-    status = linebyline.init(normalization);
-    if (status != 0)
+    if (nnormalizations == 0)
+	normalizations[nnormalizations++] = "line-oriented";
+    for (i = 0; i < nnormalizations; i++)
+    {
+	status = linebyline.init(normalizations[i]);
+	if (status != 0)
+	{
+	    fprintf(stderr, "comparator: bad analyzer option\n");
+	    exit(1);
+	}
+    }
+    if (nnormalizations > 1)
+    {
+	if (!compile_only || outfile)
+	{
+	    fputs("comparator: several -N options need -c and no -o.\n", 
+		  stderr);
+	    exit(1);
+	}
+	for (i = 0; i < nnormalizations; i++)
+	    for (j = 0; j < i; j++)
+	    {
+		char	buf1[BUFSIZ], buf2[BUFSIZ];
+
+		linebyline.select(i);
+		linebyline.dumpopt(buf1);
+		linebyline.select(j);
+		linebyline.dumpopt(buf2);
+		if (!strcmp(buf1, buf2))
+		{
+		    fprintf(stderr, "comparator: normalization %s given twice.\n", buf1);
+		    exit(1);
+		}
+	    }
+	linebyline.select(0);
+    }
+
+    if (dir && (treefd = open(dir, O_RDONLY | O_DIRECTORY)) == -1)
     {
-	fprintf(stderr, "comparator: bad analyzer option\n");
+	fprintf(stderr, "comparator: cd %s failed, %s\n", dir, strerror(errno));
 	exit(1);
     }
 
     /* special case if user gave exactly one tree */
     if (!compile_only && argcount == 1)
     {
-	if (dir)
+	FILE	*ofp = stdout;
+	int	fd;
+
+	/* -o is relative to -d here, as when we used to chdir there first */
+	if (outfile)
 	{
-	    if (chdir(dir) != 0)
+	    fd = openat(treefd, outfile, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	    if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1)
 	    {
-		fprintf(stderr, "comparator: single-tree cd %s failed!\n", dir);
+		fprintf(stderr, "comparator: can't write %s, %s\n",
+			outfile, strerror(errno));
 		exit(1);
 	    }
+	    close(fd);
 	}
-	write_scf(argv[optind], redirect(outfile));
+	write_scf(argv[optind], &ofp, false);
+	report_linecache();
 	exit(0);
     }
 
-    /* two or more arguments */
-    for(; optind < argc; optind++)
+    /* two or more arguments; candidates go first, to be sketched first */
+    if (compile_only)
+	compiles = (struct compile_t *)calloc(sizeof(struct compile_t), argcount);
+    inputs = (struct scf_t **)malloc(sizeof(struct scf_t *) * argcount);
+    for (j = 0; j < argcount; j++)
     {
-	char	*olddir = NULL, *source = argv[optind];
+	char	*source = (j < candidates) ? probes[j] : argv[optind + j - candidates];
 
-	scf = (struct scf_t *)calloc(sizeof(struct scf_t), 1);
+	scf = inputs[j] = (struct scf_t *)calloc(sizeof(struct scf_t), 1);
+	scf->candidate = (j < candidates);
 	scf->next = scflist;
 	scflist = scf;
 
-	if (is_scf_file(source))
+	if (lookup && j == 0)
+	{
+	    /*
+	     * It is entered with the corpus's window so the inputs
+	     * agree, but every shred of it is looked up, so none is
+	     * winnowed away.
+	     */
+	    init_scf(source, scf, 0);
+	    winnow = 0;
+	}
+	else if (is_scf_file(source))
 	    init_scf(source, scf, 1);
 	else if (compile_only)
 	{
-	    FILE	*ofp;
-	    char	*scf_out;	
-
-	    if (outfile)
-		scf_out = outfile;
-	    else
-	    {
-		scf_out  = alloca(strlen(source) + 4);
-		strcpy(scf_out, source);
-		strcat(scf_out, ".scf");
-	    }
-	    ofp = redirect(scf_out);
+	    struct compile_t *cp = compiles + ncompiles++;
 
-	    if (dir)
-	    {
-		olddir = getcwd(NULL, PATH_MAX);
-		if (chdir(dir) != 0)
-		{
-		    fprintf(stderr, "comparator: descent cd %s failed!\n", dir);
-		    exit(1);
-		}
-	    }
-	    write_scf(source, ofp);
-	    if (dir) {
-		if (chdir(olddir) != 0)
-		{
-		    fprintf(stderr, "comparator: return cd %s failed!\n", dir);
-		    exit(1);
-		}
-	    }
-	    fclose(ofp);
+	    cp->tree = source;
+	    cp->scf_out = (char **)malloc(sizeof(char *) * nnormalizations);
+	    for (i = 0; i < nnormalizations; i++)
+		cp->scf_out[i] = outfile ? outfile : scf_name(source, i);
 	}
 	else
-	{
-	    if (dir)
-	    {
-		olddir = getcwd(NULL, PATH_MAX);
-		if (chdir(dir) != 0)
-		{
-		    fprintf(stderr, "comparator: descent cd %s failed!\n", dir);
-		    exit(1);
-		}
-	    }
 	    init_scf(source, scf, 0);
-	    scf->totallines = merge_tree(source);
-	    if (dir)
-	    {
-		if (chdir(olddir) != 0)
-		{
-		    fprintf(stderr, "comparator: return cd %s failed!\n", dir);
-		    exit(1);
-		}
-	    }
-	}
     }
 
     if (compile_only)
+    {
+	compile_trees();
+	report_linecache();
 	exit(0);
+    }
 
     /* are we running the right instance of comparator? */
     for (scf = scflist; scf->next; scf = scf->next)
 	if (strcmp(scf->hash_method, HASHMETHOD))
 	{
 	    fprintf(stderr, 
-		    "comparator: hash method %s of %s is not compiled in.\n",
-		    scf->hash_method, scf->file);
+		    "comparator: hash method %s of %s doesn't match %s.\n",
+		    scf->hash_method, scf->file, HASHMETHOD);
 	    exit(1);
 	}
 
     /* consistency checks on the SCFs */
     for (scf = scflist; scf->next->next; scf = scf->next)
     {
+	/* trees are shredded with -w, so this goes for them too */
+	if (scf->winnow != scf->next->winnow)
+	{
+	    fprintf(stderr, 
+		    "comparator: winnowing windows of %s and %s don't match\n",
+		    scf->file, scf->next->file);
+	    exit(1);
+	}
 	if (!scf->fp)
 	    continue;
 
@@ -669,44 +2382,140 @@ main(int argc, char *argv[])
 	}
     }
 
+    /*
+     * Shred trees only now, so each one can be tested against the
+     * sketches of all the SCFs and of the trees before it.
+     */
+    if (nshards)
+	start_workers(inputs, argcount);
+    else
+    {
+	for (i = 0; i < argcount; i++)
+	    if (lookup && i == 0)
+		inputs[i]->totallines = shred_snippet(inputs[i], lookup);
+	    else if (!inputs[i]->fp)
+		inputs[i]->totallines = merge_tree(inputs[i]);
+	report_linecache();
+    }
+
+    /* hash-ordered SCFs can be merged rather than sorted */
+    streaming = !nshards && !checkpoint;
+    for (scf = scflist; scf->next; scf = scf->next)
+	if (!scf->fp || !scf->hash_order)
+	    streaming = false;
+    if (streaming && lsh_bands)
+    {
+	/* the signatures need every file's shreds before any is merged */
+	fputs("comparator: --lsh reads --sorted SCFs whole instead of merging them.\n",
+	      stderr);
+	streaming = false;
+    }
+
     /* finish reading in all SCFs */
+    if (streaming)
+	heap = (struct scf_t **)malloc(sizeof(struct scf_t *) * argcount);
     for (scf = scflist; scf->next; scf = scf->next)
-	if (scf->fp)
+	if (streaming)
+	{
+	    read_file_table(scf);
+	    progress_expect(PHASE_MERGE, scf->unread);
+	    if (read_shred(scf, &scf->head))
+		heap[nheap++] = scf;
+	}
+	else if (scf->fp && !nshards)
 	{
-	    read_scf(scf);
+	    if (scf->fences)
+		lookup_scf(scf);
+	    else
+		read_scf(scf);
 	    scf->file[strlen(scf->file) - strlen(".scf")] = '\0';
 	    fclose(scf->fp);
 	}
+    for (i = nheap / 2 - 1; i >= 0; i--)
+	sift_down(i);
+
+    /* a candidate nothing was read from can only match nothing */
+    for (scf = scflist; scf->next; scf = scf->next)
+	if (scf->candidate && !lookup)
+	{
+	    struct filehdr_t	*fp;
+
+	    for (fp = filelist; fp->next; fp = fp->next)
+		if (fp->candidate && in_tree(fp->name, scf->name))
+		    break;
+	    if (!fp->next)
+		fprintf(stderr, "comparator: -C %s has no files to compare.\n",
+			scf->name);
+	}
 
     if (debug)
 	dump_array("Consolidated hash list:\n", sort_buffer, sort_count);
 
     /* now we're ready to emit the report */
     redirect(outfile);
-    puts("#SCF-B 2.0");
-    printf("Filtering: %s\n", nofilter ? "none" : "language");
-    printf("Hash-Method: %s\n", scflist->hash_method);
+    header("#SCF-B 2.0\n");
+    if (binary_report)
+	header("Encoding: binary\n");
+    header("Filtering: %s\n", nofilter ? "none" : "language");
+    header("Hash-Method: %s\n", scflist->hash_method);
 
-    report_time("Hash merge done, %d shreds", sort_count);
-    sort_hashes(sort_buffer, sort_count);
-    report_time("Sort done");
-
-    mergecount = merge_compare(sort_buffer, sort_count);
-    printf("Matches: %d\n", mergecount);
-    puts("Merge-Program: comparator " VERSION);
-    printf("Normalization: %s\n", scflist->normalization);
-    printf("Shred-Size: %d\n", scflist->shred_size);
+    if (nshards)
+    {
+	mergecount = merge_stream(next_from_workers);
+	finish_workers();
+    }
+    else if (streaming)
+    {
+	mergecount = merge_stream(next_shred);
+	for (scf = scflist; scf->next; scf = scf->next)
+	{
+	    read_trailer(scf);
+	    scf->file[strlen(scf->file) - strlen(".scf")] = '\0';
+	    fclose(scf->fp);
+	}
+    }
+    else if (resume)
+	mergecount = merge_compare(sort_buffer, sort_count);
+    else
+    {
+	report_time("Hash merge done, %d shreds", sort_count);
+	if (lsh_bands)
+	{
+	    phase_begin(PHASE_LSH);
+	    sort_count = lsh_filter(filelist, sort_buffer, sort_count);
+	    phase_end(PHASE_LSH);
+	}
+	phase_begin(PHASE_SORT);
+	sort_hashes(sort_buffer, sort_count);
+	phase_end(PHASE_SORT);
+	report_time("Sort done");
+	sort_count = compact_hashes(&sort_buffer, sort_count);
+	if (checkpoint)
+	    write_checkpoint(checkpoint, sort_buffer, sort_count);
+
+	mergecount = merge_compare(sort_buffer, sort_count);
+    }
+    header("Matches: %d\n", mergecount);
+    header("Merge-Program: comparator " VERSION "\n");
+    header("Normalization: %s\n", scflist->normalization);
+    header("Shred-Size: %d\n", scflist->shred_size);
 
-    puts("%%");
+    header("%%%%\n");
     for (scf = scflist; scf->next; scf = scf->next)
-	printf("%s: matches=%d, matchlines=%d, totallines=%d\n", 
+	header("%s: matches=%d, matchlines=%d, totallines=%d\n", 
 	       scf->name, 
 	       match_count(scf->name), 
 	       line_count(scf->name), 
 	       scf->totallines);
-    puts("%%");
+    header("%%%%\n");
 
-    emit_report();
+    phase_begin(PHASE_EMIT);
+    if (binary_report)
+	emit_binary_report(header_bytes);
+    else
+	emit_report();
+    fflush(stdout);
+    phase_end(PHASE_EMIT);
 
     exit(0);
 }
@@ -0,0 +1,52 @@
+/* Declarations of functions and data types used for MD5 sum computing.
+   Only the entry points md5.c still carries are declared here. */
+/* SPDX-License-Identifier: GPL-2.0+ */
+
+#ifndef _MD5_H
+#define _MD5_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t md5_uint32;
+
+/* Structure to save state of computation between the single steps.  */
+struct md5_ctx
+{
+  md5_uint32 A;
+  md5_uint32 B;
+  md5_uint32 C;
+  md5_uint32 D;
+
+  md5_uint32 total[2];
+  md5_uint32 buflen;
+  char buffer[128] __attribute__ ((__aligned__ (__alignof__ (md5_uint32))));
+};
+
+/* Initialize structure containing state of computation. */
+extern void md5_init_ctx (struct md5_ctx *ctx);
+
+/* Starting with the result of former calls of this function (or the
+   initialization function update the context for the next LEN bytes
+   starting at BUFFER.  It is necessary that LEN is a multiple of 64!!! */
+extern void md5_process_block (const void *buffer, size_t len,
+			       struct md5_ctx *ctx);
+
+/* Starting with the result of former calls of this function (or the
+   initialization function update the context for the next LEN bytes
+   starting at BUFFER.  It is NOT required that LEN is a multiple of 64.  */
+extern void md5_process_bytes (const void *buffer, size_t len,
+			       struct md5_ctx *ctx);
+
+/* Process the remaining bytes in the buffer and put result from CTX
+   in first 16 bytes following RESBUF.  The result is always in little
+   endian byte order, so that a byte-wise output yields to the wanted
+   ASCII representation of the message digest.  */
+extern void *md5_finish_ctx (struct md5_ctx *ctx, void *resbuf);
+
+/* Put result from CTX in first 16 bytes following RESBUF.  */
+extern void *md5_read_ctx (const struct md5_ctx *ctx, void *resbuf);
+
+#define rol(x, n) (((x) << (n)) | ((md5_uint32) (x) >> (32 - (n))))
+
+#endif /* _MD5_H */
@@ -81,15 +81,26 @@ static int merge_ranges(struct sorthash_t *p,
     return(1);
 }
 
-static bool sametree(const char *s, const char *t)
+bool sametree(const char *s, const char *t)
 /* are two files from the same tree? */
 {
-    int sn = strchr(s, '/') - s;
-    int tn = strchr(t, '/') - t;
+    int sn = strcspn(s, "/");
+    int tn = strcspn(t, "/");
 
     return (sn == tn) && !strncmp(s, t, sn); 
 }
 
+static bool heterogenous(struct sorthash_t *np, int nmatches)
+/* do the shreds in a clique come from more than one tree? */
+{
+    int i;
+
+    for (i = 0; i < nmatches; i++)
+	if (!sametree(np[i].file->name, np[(i+1) % nmatches].file->name))
+	    return(true);
+    return(false);
+}
+
 static int compare_files(const void *a, const void *b)
 /* sort by files shred is included in */
 {
@@ -214,6 +225,37 @@ static int collapse_ranges(struct match_t *reduced, int nonuniques)
     return(nonuniques - removed);
 }
 
+static bool has_candidate(struct sorthash_t *np, int nmatches)
+/* does a clique hold a shred from a -C input? */
+{
+    int i;
+
+    for (i = 0; i < nmatches; i++)
+	if (np[i].file->candidate)
+	    return(true);
+    return(false);
+}
+
+static int drop_corpus_cliques(struct sorthash_t *obarray, const int hashcount)
+/* with -C, drop the cliques no candidate takes part in */
+{
+    struct sorthash_t *mp, *np, *tp;
+
+    for (tp = np = obarray; np < obarray + hashcount; np = mp)
+    {
+	for (mp = np + 1; mp < obarray + hashcount; mp++)
+	    if (SORTHASHCMP(np, mp))
+		break;
+	if (has_candidate(np, mp - np))
+	{
+	    memmove(tp, np, sizeof(struct sorthash_t) * (mp - np));
+	    tp += mp - np;
+	}
+    }
+    COUNT(dropped_corpus, hashcount - (tp - obarray));
+    return (tp - obarray);
+}
+
 static int compact_matches(struct sorthash_t *obarray, const int hashcount)
 /* compact the hash list by removing obvious uniques */
 {
@@ -236,6 +278,8 @@ static int compact_matches(struct sorthash_t *obarray, const int hashcount)
       *
       * The technique: first mark...
       */
+     if (hashcount < 2)
+	 return(0);		/* no room for a match */
      if (SORTHASHCMP(obarray, obarray+1))
 	 obarray[0].hash.flags = INTERNAL_FLAG;
      for (np = obarray+1; np < obarray + hashcount-1; np++)
@@ -247,6 +291,10 @@ static int compact_matches(struct sorthash_t *obarray, const int hashcount)
      for (mp = np = obarray; np < obarray + hashcount; np++)
 	 if (np->hash.flags != INTERNAL_FLAG)
 	     *mp++ = *np;
+     COUNT(dropped_compact, hashcount - (mp - obarray));
+     /* candidate runs only want what they share with the corpus */
+     if (candidates)
+	 mp = obarray + drop_corpus_cliques(obarray, mp - obarray);
      /* now we get to reduce the memory footprint */
      report_time("Compaction reduced %d shreds to %d", 
 		 hashcount, mp - obarray);
@@ -257,7 +305,7 @@ struct match_t *reduce_matches(struct sorthash_t *obarray, int *hashcountp)
 /* assemble list of duplicated hashes */
 {
      unsigned int nonuniques, nreduced, progress, hashcount = *hashcountp;
-     struct sorthash_t *mp, *np;
+     struct sorthash_t *mp, *np, *mark;
      struct match_t	*reduced;
 
      if (debug)
@@ -269,15 +317,25 @@ struct match_t *reduce_matches(struct sorthash_t *obarray, int *hashcountp)
      /* build list of hashes with more than one range associated */
      nonuniques = progress = 0;
      if (verbose)
-	 fprintf(stderr, "%% Extracting duplicates...   ");
+     {
+	 fprintf(stderr, "%% Extracting duplicates...");
+	 percent_begin();
+     }
+     progress_expect(PHASE_REDUCE, hashcount);
      nreduced = 10000;
      reduced = (struct match_t *)malloc(sizeof(struct match_t) * nreduced);
-     for (np = obarray; np < obarray + hashcount; np = mp)
+     for (mark = np = obarray; np < obarray + hashcount; np = mp)
      {
-	 int i, heterogenous, nmatches;
+	 int i, nmatches;
 
-	 if (verbose && !debug && progress++ % 10000 == 0)
-	     fprintf(stderr, "\b\b\b%02.0f%%", progress / (hashcount * 0.01));
+	 if (progress++ % 10000 == 0)
+	 {
+	     progress_advance(PHASE_REDUCE, np - mark);
+	     mark = np;
+	     if (percent_display())
+		 fprintf(stderr, "\b\b\b\b%3.0f%%",
+			 (np - obarray) / (hashcount * 0.01));
+	 }
 
 	 /* count the number of hash matches */
 	 nmatches = 1;
@@ -288,13 +346,11 @@ struct match_t *reduce_matches(struct sorthash_t *obarray, int *hashcountp)
 		 nmatches++;
 
 	 /* if all these matches are within the same tree, toss them */
-	 heterogenous = 0;
-	 for (i = 0; i < nmatches; i++)
-	     if (!sametree(np[i].file->name, np[(i+1) % nmatches].file->name))
-		 heterogenous++;
-	 if (!heterogenous)
+	 if (!heterogenous(np, nmatches))
 	 {
-	     np[i].hash.flags = INTERNAL_FLAG;	/* used only in debug code */
+	     COUNT(dropped_reduce, nmatches);
+	     for (i = 0; i < nmatches; i++)
+		 np[i].hash.flags = INTERNAL_FLAG; /* used only in debug code */
 	     continue;
 	 }
 
@@ -312,6 +368,7 @@ struct match_t *reduce_matches(struct sorthash_t *obarray, int *hashcountp)
 	     nreduced *= 2;
 	     reduced = (struct match_t *)realloc(reduced,
 						 sizeof(struct match_t)*nreduced);
+	     COUNT(reallocs, 1);
 	 }
 	 /*
 	  * Point into the existing hash array rather than allocating
@@ -323,8 +380,12 @@ struct match_t *reduce_matches(struct sorthash_t *obarray, int *hashcountp)
 	 reduced[nonuniques].nmatches = nmatches;
 	 nonuniques++;
      }
+     progress_advance(PHASE_REDUCE, np - mark);
      if (verbose)
-	 fprintf(stderr, "\b\b\b100%% done.\n");
+     {
+	 percent_done();
+	 fprintf(stderr, " done.\n");
+     }
 
      *hashcountp = nonuniques;
      return reduced;
@@ -361,22 +422,16 @@ static int sortmatch(const void *a, const void *b)
 static struct match_t *hitlist;
 static int mergecount;
 
-int merge_compare(struct sorthash_t *obarray, int hashcount)
-/* report our results (header portion) */
+static void merge_matches(int matchcount)
+/* collapse, filter and sort the range groups in the hit list */
 {
     struct match_t *match, *copy;
-    int matchcount;
-
-    hashcount = compact_matches(obarray, hashcount);
-    obarray = (struct sorthash_t *)realloc(obarray, 
-				   sizeof(struct sorthash_t)*hashcount);
-    matchcount = hashcount;
-    hitlist = reduce_matches(obarray, &matchcount);
-    if (debug)
-	dump_array("After removing uniques.\n", obarray, hashcount);
-    report_time("%d range groups after removing unique hashes", matchcount);
 
+    phase_begin(PHASE_COLLAPSE);
     mergecount = collapse_ranges(hitlist, matchcount);
+    COUNT(dropped_collapse, matchcount - mergecount);
+    phase_end(PHASE_COLLAPSE);
+    phase_begin(PHASE_FILTER);
     /*
      * Here's where we do significance filtering.  As a side effect,
      * compact the match list in order to cut the n log n qsort time
@@ -414,17 +469,152 @@ int merge_compare(struct sorthash_t *obarray, int hashcount)
 		*copy++ = *match;
 	}
 
+    COUNT(dropped_filter, mergecount - (copy - hitlist));
     mergecount = (copy - hitlist);
+    phase_end(PHASE_FILTER);
 
     /* sort everything so the report looks neat */
     qsort(hitlist, mergecount, sizeof(struct match_t), sortmatch);
+}
+
+int compact_hashes(struct sorthash_t **obarrayp, int hashcount)
+/* drop unique hashes from a sorted list, returning how many are left */
+{
+    phase_begin(PHASE_COMPACT);
+    hashcount = compact_matches(*obarrayp, hashcount);
+    *obarrayp = (struct sorthash_t *)realloc(*obarrayp, 
+				   sizeof(struct sorthash_t)*hashcount);
+    COUNT(reallocs, 1);
+    phase_end(PHASE_COMPACT);
+    return(hashcount);
+}
+
+int merge_compare(struct sorthash_t *obarray, int hashcount)
+/* report our results (header portion) from a compacted hash list */
+{
+    int matchcount;
+
+    matchcount = hashcount;
+    phase_begin(PHASE_REDUCE);
+    hitlist = reduce_matches(obarray, &matchcount);
+    phase_end(PHASE_REDUCE);
+    if (debug)
+	dump_array("After removing uniques.\n", obarray, hashcount);
+    report_time("%d range groups after removing unique hashes", matchcount);
+
+    merge_matches(matchcount);
 
     if (debug)
 	dump_array("After merging ranges.\n", obarray, hashcount);
     report_time("%d range groups after merging", mergecount);
 
     return(mergecount);
- }
+}
+
+void export_cliques(struct sorthash_t *obarray, int hashcount,
+		    void (*emit)(struct sorthash_t *, int))
+/* hand each clique that survives compaction and reduction to emit() */
+{
+    struct match_t	*cliques;
+    int		i, matchcount;
+
+    /* the range merge is left to whoever gathers the cliques */
+    if (hashcount < 2)
+	return;
+    phase_begin(PHASE_COMPACT);
+    hashcount = compact_matches(obarray, hashcount);
+    phase_end(PHASE_COMPACT);
+    matchcount = hashcount;
+    phase_begin(PHASE_REDUCE);
+    cliques = reduce_matches(obarray, &matchcount);
+    phase_end(PHASE_REDUCE);
+    for (i = 0; i < matchcount; i++)
+	emit(cliques[i].matches, cliques[i].nmatches);
+    free(cliques);
+}
+
+int merge_stream(bool (*next)(struct sorthash_t *))
+/* report our results (header portion) from shreds arriving in order */
+{
+    struct sorthash_t this, *clique, *kept;
+    int nclique, nkept, matchcount, shredcount, i;
+    size_t clique_alloc, kept_alloc, hit_alloc;
+    bool more;
+
+    /*
+     * The shreds come to us in the order sort_hashes() would have put
+     * them in, so we can do what compact_matches() and reduce_matches()
+     * do one clique at a time.  Only the shreds of cliques that survive
+     * are kept, so we never hold the whole corpus the way the sort
+     * does.  Kept cliques are stored in hit-list order, so their
+     * places can be filled in once the kept shreds have stopped moving.
+     */
+    phase_begin(PHASE_MERGE);
+    clique_alloc = kept_alloc = hit_alloc = 0;
+    clique = kept = NULL;
+    hitlist = NULL;
+    nclique = nkept = matchcount = shredcount = 0;
+    do {
+	more = next(&this);
+	if (nclique && (!more || SORTHASHCMP(&this, clique)))
+	{
+	    if (nclique == 1)
+		COUNT(dropped_compact, 1);
+	    else if (candidates && !has_candidate(clique, nclique))
+		COUNT(dropped_corpus, nclique);
+	    else if (!heterogenous(clique, nclique))
+		COUNT(dropped_reduce, nclique);
+	    else
+	    {
+		if (nkept + nclique > kept_alloc)
+		{
+		    kept_alloc = 2 * kept_alloc + nclique;
+		    kept = (struct sorthash_t *)realloc(kept, 
+				sizeof(struct sorthash_t) * kept_alloc);
+		    COUNT(reallocs, 1);
+		}
+		if (matchcount >= hit_alloc)
+		{
+		    hit_alloc = 2 * hit_alloc + 1024;
+		    hitlist = (struct match_t *)realloc(hitlist, 
+				sizeof(struct match_t) * hit_alloc);
+		    COUNT(reallocs, 1);
+		}
+		memcpy(kept + nkept, clique, sizeof(struct sorthash_t) * nclique);
+		hitlist[matchcount].matches = NULL;
+		hitlist[matchcount].nmatches = nclique;
+		matchcount++;
+		nkept += nclique;
+	    }
+	    nclique = 0;
+	}
+	if (more)
+	{
+	    if (nclique >= clique_alloc)
+	    {
+		clique_alloc = 2 * clique_alloc + 16;
+		clique = (struct sorthash_t *)realloc(clique, 
+				sizeof(struct sorthash_t) * clique_alloc);
+	    }
+	    clique[nclique++] = this;
+	    shredcount++;
+	}
+    } while
+	(more);
+    for (i = nkept = 0; i < matchcount; nkept += hitlist[i++].nmatches)
+	hitlist[i].matches = kept + nkept;
+    free(clique);
+    phase_end(PHASE_MERGE);
+    report_time("Merge of %d shreds done, %d range groups after removing unique hashes", shredcount, matchcount);
+
+    merge_matches(matchcount);
+
+    if (debug)
+	dump_array("After merging ranges.\n", kept, nkept);
+    report_time("%d range groups after merging", mergecount);
+
+    return(mergecount);
+}
 
 void emit_report(void)
 /* report our results (matches) */
@@ -450,6 +640,143 @@ void emit_report(void)
     /* free(hitlist); */
 }
 
+static int namesort(const void *a, const void *b)
+/* sort file headers by name */
+{
+    return strcmp((*(struct filehdr_t **)a)->name,
+		  (*(struct filehdr_t **)b)->name);
+}
+
+static void put_uint(u_int32_t val)
+/* emit a uint in network byte order */
+{
+    val = htonl(val);
+    fwrite(&val, sizeof(u_int32_t), 1, stdout);
+}
+
+static int byfile_cmp(const void *a, const void *b)
+/* order range records by file index, then by start line */
+{
+    const u_int32_t *s = (const u_int32_t *)a, *t = (const u_int32_t *)b;
+
+    if (s[0] != t[0])
+	return((s[0] < t[0]) ? -1 : 1);
+    else if (s[1] != t[1])
+	return((s[1] < t[1]) ? -1 : 1);
+    else
+	return((s[2] < t[2]) ? -1 : 1);
+}
+
+void emit_binary_report(long offset)
+/* report our results (matches) in the binary encoding of SCF-B */
+{
+    struct match_t *match;
+    struct sorthash_t *rp;
+    struct filehdr_t **filetable;
+    u_int32_t	nranges, strtab_size, *byfile, *fp;
+    int		i, j, nfiles;
+
+    /*
+     * Collect every file mentioned in the report.  The same path may
+     * be registered more than once (e.g. when a tree is named twice),
+     * so sort by name and squeeze out duplicates; the index of a file
+     * in the resulting table is its index in the string table, and is
+     * noted in every filehdr of that name.
+     */
+    nranges = 0;
+    for (match = hitlist; match < hitlist + mergecount; match++)
+	nranges += match->nmatches;
+    filetable = (struct filehdr_t **)malloc(sizeof(struct filehdr_t *) * (nranges + 1));
+    nfiles = 0;
+    for (match = hitlist; match < hitlist + mergecount; match++)
+	for (rp = match->matches; rp < match->matches + match->nmatches; rp++)
+	    filetable[nfiles++] = rp->file;
+    qsort(filetable, nfiles, sizeof(struct filehdr_t *), namesort);
+    for (i = j = 0; i < nfiles; i++)
+    {
+	struct filehdr_t *file = filetable[i];
+
+	if (j == 0 || strcmp(file->name, filetable[j-1]->name))
+	    filetable[j++] = file;
+	file->report_index = j - 1;
+    }
+    nfiles = j;
+
+    /*
+     * Build the by-file index: (file, start, range number) triples
+     * sorted so that all ranges in a given file are adjacent and in
+     * line order.
+     */
+    byfile = (u_int32_t *)malloc(sizeof(u_int32_t) * 3 * (nranges + 1));
+    fp = byfile;
+    i = 0;
+    for (match = hitlist; match < hitlist + mergecount; match++)
+	for (rp = match->matches; rp < match->matches + match->nmatches; rp++)
+	{
+	    *fp++ = rp->file->report_index;
+	    *fp++ = rp->hash.start;
+	    *fp++ = i++;
+	}
+    qsort(byfile, nranges, sizeof(u_int32_t) * 3, byfile_cmp);
+
+    strtab_size = 0;
+    for (i = 0; i < nfiles; i++)
+	strtab_size += strlen(filetable[i]->name) + 1;
+
+    /* NULs up to an 8-byte boundary of the report, so it can be mapped */
+    while (offset++ % 8)
+	putchar('\0');
+
+    /* counts */
+    put_uint(nfiles);
+    put_uint(nranges);
+    put_uint(mergecount);
+    put_uint(strtab_size);
+
+    /* file index: name offset, length, first by-file slot, range count */
+    for (i = 0, fp = byfile, strtab_size = 0; i < nfiles; i++)
+    {
+	int first = fp - byfile;
+
+	while (fp < byfile + 3 * nranges && fp[0] == i)
+	    fp += 3;
+	put_uint(strtab_size);
+	put_uint(filetable[i]->length);
+	put_uint(first / 3);
+	put_uint((fp - byfile - first) / 3);
+	strtab_size += strlen(filetable[i]->name) + 1;
+    }
+
+    /* clique index, with a sentinel so clique sizes are derivable */
+    for (match = hitlist, i = 0; match < hitlist + mergecount; match++)
+    {
+	put_uint(i);
+	i += match->nmatches;
+    }
+    put_uint(i);
+
+    /* fixed-width range records in report order */
+    for (match = hitlist; match < hitlist + mergecount; match++)
+	for (rp = match->matches; rp < match->matches + match->nmatches; rp++)
+	{
+	    put_uint(rp->file->report_index);
+	    put_uint(rp->hash.start);
+	    put_uint(rp->hash.end);
+	    put_uint(match - hitlist);
+	}
+
+    /* ranges grouped by file */
+    for (fp = byfile; fp < byfile + 3 * nranges; fp += 3)
+	put_uint(fp[2]);
+
+    /* the string table itself */
+    for (i = 0; i < nfiles; i++)
+	fwrite(filetable[i]->name, strlen(filetable[i]->name) + 1, 1, stdout);
+
+    free(byfile);
+    free(filetable);
+}
+
 int match_count(const char *name)
 /* return count of matches with given tree in them */
 {
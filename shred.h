@@ -4,6 +4,10 @@
  * SPDX-License-Identifier: BSD-2-clause
  */
 
+#ifndef SHRED_H
+#define SHRED_H
+
+#include <stdbool.h>
 #include <sys/types.h>
 #include <netinet/in.h>
 
@@ -13,20 +17,15 @@ typedef uint16_t u_int16_t;
 typedef uint32_t u_int32_t;
 #endif
 
-#ifndef LARGEFILES
 /*
- * 65,536 lines should be enough, but make it possible to compile with 32 bits.
- * The point of making it a short is that the data sets can get quite large,
- * so we want the hash_t and sorthash_t structures to be small.
+ * Line numbers are 32 bits in core; on LP64 they fit in padding the
+ * hash_t already had.  In an SCF each file's line numbers are written
+ * as shorts unless the file is too long for that, so the SCFs of
+ * ordinary trees stay as small as they always were.
  */
-typedef u_int16_t	linenum_t;
-#define TONET		htons
-#define FROMNET		ntohs
-#else
 typedef u_int32_t	linenum_t;
-#define TONET		htonl
-#define FROMNET		ntohl
-#endif
+#define NARROW_MAX	0xfffe		/* largest short line number */
+#define WIDE_ESCAPE	0xffff		/* short marking a wide file */
 #define MAX_LINENUM	(linenum_t)-1	/* 2s-complement assumption */
 
 /* use this to hold total line count of the entire source tree set */
@@ -51,6 +50,11 @@ struct filehdr_t	/* file/attributes structure describing input source */
 {
     char	*name;
     linenum_t	length;
+    u_int64_t	*minhash;	/* MinHash signature, if --lsh is on */
+    bool	alike;		/* shares an LSH bucket with another tree */
+    bool	candidate;	/* from an input named with -C */
+    u_int32_t	serial;		/* order of registration */
+    u_int32_t	report_index;	/* string-table index in a binary report */
     struct filehdr_t *next;
 };
 
@@ -67,11 +71,29 @@ typedef struct		/* structure describing an input feature */
 }
 feature_t;
 
+struct source_t		/* contents of an input file, mapped or buffered */
+{
+    char	*base;
+    size_t	size;
+    size_t	cursor;		/* read position for source_gets() */
+    bool	mapped;
+    bool	borrowed;	/* points into a tar archive held elsewhere */
+};
+
+struct chunklist_t	/* growable list of the hashes from one file */
+{
+    struct hash_t	*chunks;
+    int			count, alloc;
+};
+
 struct analyzer_t	/* structure describing a feature analyzer */
 {
     int (*init)(const char *);
+    void (*select)(int);
     void (*mode)(int);
-    feature_t *(*get)(const struct filehdr_t *, FILE *, linenum_t *);
+    void (*resume)(int, linenum_t);
+    int (*current)(void);
+    feature_t *(*get)(const struct filehdr_t *, struct source_t *, linenum_t *);
     void (*free)(const char *);
     void (*dumpopt)(char *);
 };
@@ -81,31 +103,105 @@ struct analyzer_t	/* structure describing a feature analyzer */
 #define SHELL_CODE	0x02	/* identified as shell code */
 
 /* control bits, meant to be set at startup */
-extern int verbose, debug, nofilter;
-extern int shredsize, minsize;
+extern int verbose, debug, nofilter, candidates;
+extern int shredsize, minsize, shred_threads, winnow;
 
 /* main.c functions */
 extern void report_time(char *legend, ...);
 struct filehdr_t *register_file(const char *file, linenum_t length);
 extern void corehook(struct hash_t hash, struct filehdr_t *file);
-extern void extend_current_chunk(linenum_t);
 extern void dump_array(const char *legend,
 		       struct sorthash_t *obarray, int hashcount);
 extern void dump_flags(const int flags, FILE *fp);
 
 /* shredtree.c functions */
-extern char **sorted_file_list(const char *, int *);
-extern int shredfile(struct filehdr_t *, 
-		     void (*hook)(struct hash_t, struct filehdr_t *));
+extern char **sorted_file_list(int, const char *, int *);
+extern char *tree_name(int, const char *);
+extern void tarball_release(const char *);
+extern void shred_files(int, char **, int, int,
+			void (*consume)(void *, const char *, int,
+					struct chunklist_t *),
+			void *);
+extern void shred_source(const char *, struct source_t *, int,
+			 void (*consume)(void *, const char *, int,
+					 struct chunklist_t *),
+			 void *);
+extern bool source_open(struct source_t *, int, const char *);
+extern char *source_gets(char *, int, struct source_t *);
+extern void source_close(struct source_t *);
+extern int shred_order(const struct sorthash_t *, const struct sorthash_t *);
 extern void sort_hashes(struct sorthash_t *hashlist, int hashcount);
 
+/* stats.c functions */
+enum {PHASE_WALK, PHASE_SHRED, PHASE_SCF_WRITE, PHASE_SCF_READ, PHASE_SORT,
+      PHASE_COMPACT, PHASE_REDUCE, PHASE_COLLAPSE, PHASE_FILTER, PHASE_EMIT,
+      PHASE_MERGE, PHASE_LSH, NPHASES};
+struct stats_t		/* run counters, dumped by --stats */
+{
+    u_int64_t	files, lines;
+    u_int64_t	regexec_calls, bytes_hashed, bytes_read, reallocs;
+    u_int64_t	shreds_generated, shreds_loaded;
+    u_int64_t	dropped_compact, dropped_reduce;
+    u_int64_t	dropped_collapse, dropped_filter;
+    u_int64_t	dropped_sketch, dropped_winnow, dropped_lsh;
+    u_int64_t	dropped_corpus;
+    u_int64_t	linecache_hits, linecache_misses;
+};
+extern struct stats_t stats;
+#define COUNT(field, n)	__atomic_fetch_add(&stats.field, (n), __ATOMIC_RELAXED)
+/* per-line counts go to the thread's own copy until flush_counts() */
+extern __thread struct stats_t thread_stats;
+#define COUNT_HERE(field, n)	(thread_stats.field += (n))
+extern void flush_counts(void);
+extern u_int64_t monotonic_ns(void);
+extern void phase_begin(int phase);
+extern void phase_end(int phase);
+extern int progress_fd;
+extern void progress_expect(int phase, u_int64_t total);
+extern void progress_advance(int phase, u_int64_t n);
+extern void progress_start(int fd, bool json);
+extern bool percent_display(void);
+extern void percent_begin(void);
+extern void percent_done(void);
+extern long peak_rss(void);
+extern void write_stats(const char *file);
+
+/* sketch.c functions */
+struct sketch_t		/* Bloom filter over a set of shred hashes */
+{
+    u_int32_t		probes;		/* bits set per hash */
+    u_int32_t		log2bits;	/* the filter is 2^log2bits bits */
+    unsigned char	*bits;
+};
+#define SKETCH_BYTES(sp)	((size_t)1 << ((sp)->log2bits - 3))
+extern struct sketch_t *sketch_new(size_t);
+extern void sketch_add(struct sketch_t *, const hashval_t *);
+extern bool sketch_test(const struct sketch_t *, const hashval_t *);
+extern void sketch_write(const struct sketch_t *, FILE *);
+extern struct sketch_t *sketch_read(FILE *);
+extern void sketch_free(struct sketch_t *);
+extern u_int64_t hash_mix(const hashval_t *);
+
+/* lsh.c functions */
+extern int lsh_bands;
+extern void lsh_add(struct filehdr_t *, const hashval_t *);
+extern int lsh_filter(struct filehdr_t *, struct sorthash_t *, int);
+
 /* linebyline.c feature analyzer */
-struct analyzer_t linebyline;
+extern struct analyzer_t linebyline;
 
 /* shredcompare.c functions */
+extern int compact_hashes(struct sorthash_t **obarrayp, int hashcount);
 extern int merge_compare(struct sorthash_t *obarray, int hashcount);
+extern int merge_stream(bool (*next)(struct sorthash_t *));
+extern void export_cliques(struct sorthash_t *, int,
+			   void (*emit)(struct sorthash_t *, int));
 extern void emit_report(void);
+extern void emit_binary_report(long);
+extern bool sametree(const char *, const char *);
 extern int match_count(const char *name);
 extern int line_count(const char *name);
 
+#endif /* SHRED_H */
+
 /* shred.h ends here */
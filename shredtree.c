@@ -7,16 +7,12 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
-
-#if defined(__FreeBSD__)
-# include <sys/types.h>
-# include <sys/stat.h>
-# include <fts.h>
-# define FTW_F 1
-#else
-# include <ftw.h>
-#endif
-
+#include <fcntl.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <search.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <ctype.h>
 #include <stdlib.h>
@@ -25,16 +21,7 @@
 
 /* control bits, meant to be set at startup */
 int shredsize = 3;
-
-struct item
-{
-    char	*file;
-    struct item *next;
-}
-dummy;
-static struct item *head = &dummy;
-
-static int file_count;
+int winnow = 0;			/* window of the -w fingerprint mode */
 
 /*************************************************************************
  *
@@ -43,130 +30,923 @@ static int file_count;
  *************************************************************************/
 
 #define MIN_PRINTABLE	0.9
+#define SNIFF_PREFIX	(BUFSIZ-2)	/* longest first line we look at */
+
+enum {INELIGIBLE, ELIGIBLE, SNIFF};
 
-static bool eligible(const char *file)
-/* is the specified file eligible to be compared? */ 
+static int eligible_name(const char *file)
+/* can we tell from its name whether the file is eligible to be compared? */ 
 {
-#define endswith(suff)	!strcmp(suff, file + strlen(file) - strlen(suff))
+#define endswith(suff)	(strlen(file) >= strlen(suff) && !strcmp(suff, file + strlen(file) - strlen(suff)))
     if (strstr(file, "CVS") || strstr(file,"RCS") || strstr(file,"SCCS") || strstr(file, "SVN") || endswith(".svn") || endswith(".git") || endswith(".hg") || endswith(".bzr"))
-	return(false);
+	return(INELIGIBLE);
     /* fast check for the most common suffixes */
     else if (endswith(".c") || endswith(".h") || endswith(".html"))
-	return(true);
+	return(ELIGIBLE);
     else if (endswith(".o") || endswith("~") || endswith(".bdf"))
-	return(false);
+	return(INELIGIBLE);
 #undef endswith
     else
+	return(SNIFF);
+}
+
+static bool eligible_text(const char *text, size_t size)
+/* is the first line of this text printable enough to be worth comparing? */
+{
+    const unsigned char *cp = (const unsigned char *)text, *end;
+    size_t	len = size < SNIFF_PREFIX ? size : SNIFF_PREFIX, i;
+    unsigned	printable = 0;
+
+    /* same extent as the first fgets() of a line, up to any NUL */
+    if ((end = memchr(cp, '\n', len)))
+	len = end - cp + 1;
+    if ((end = memchr(cp, '\0', len)))
+	len = end - cp;
+
+    /*
+     * Count graphic characters and whitespace, as isgraph() || isspace()
+     * would in the C locale.  There are no branches in the loop body,
+     * so the compiler can vectorize it.
+     */
+    for (i = 0; i < len; i++)
+	printable += ((unsigned char)(cp[i] - ' ') < 0x5f)
+	    | ((unsigned char)(cp[i] - '\t') < 5);
+
+    /* are we over the critical percentage? */
+    return (printable >= MIN_PRINTABLE * len);
+}
+
+/*
+ * A tree may also be a tar archive, or "-" for one on standard input,
+ * so that drops needn't be extracted to be compared.  The archive is
+ * mapped (or read, from a pipe) whole, and its regular files are
+ * listed under the archive's name less its .tar suffix, as if that
+ * were the directory they had been extracted into.  Loading a member
+ * then just points into the archive.  POSIX ustar, GNU long names and
+ * pax path and size records are understood; links, devices and sparse
+ * files are skipped.
+ */
+
+#define TAR_BLOCK	512
+#define TAR_STDIN	"stdin"		/* what an archive read from - is called */
+
+struct member_t		/* a regular file in an archive */
+{
+    char	*name;		/* full path, root included */
+    const char	*data;
+    size_t	size;
+    int		seq;		/* position in the archive */
+};
+
+struct archive_t
+{
+    char	*root;
+    char	*base;
+    size_t	size;
+    bool	mapped;
+    struct member_t *members;	/* sorted by name */
+    int		nmembers;
+    struct archive_t *next;
+};
+
+static struct archive_t *archives;
+static pthread_mutex_t archive_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool is_tarball(int dirfd, const char *tree)
+/* is this tree argument a tar archive rather than a directory or file? */
+{
+    size_t	len = strlen(tree);
+    struct stat	sb;
+
+    if (!strcmp(tree, "-"))
+	return(true);
+    return(len > 4 && !strcmp(tree + len - 4, ".tar")
+	   && fstatat(dirfd, tree, &sb, 0) == 0 && S_ISREG(sb.st_mode));
+}
+
+char *tree_name(int dirfd, const char *tree)
+/* what the files of a tree are listed under */
+{
+    char	*name;
+
+    if (!is_tarball(dirfd, tree))
+	return(strdup(tree));
+    else if (!strcmp(tree, "-"))
+	return(strdup(TAR_STDIN));
+    name = strdup(tree);
+    name[strlen(name) - 4] = '\0';
+    return(name);
+}
+
+static u_int64_t tar_number(const unsigned char *field, int len)
+/* decode a numeric header field, octal or GNU base-256 */
+{
+    u_int64_t	n = 0;
+    int		i;
+
+    if (field[0] & 0x80)
+    {
+	n = field[0] & 0x3f;
+	for (i = 1; i < len; i++)
+	    n = (n << 8) | field[i];
+	return(n);
+    }
+    for (i = 0; i < len && field[i] == ' '; i++)
+	continue;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+	n = (n << 3) | (field[i] - '0');
+    return(n);
+}
+
+static bool tar_header(const unsigned char *hp)
+/* does a block carry a valid header checksum? */
+{
+    unsigned	sum = 0;
+    int		i;
+
+    for (i = 0; i < TAR_BLOCK; i++)
+	sum += (i >= 148 && i < 156) ? ' ' : hp[i];
+    return(sum == tar_number(hp + 148, 8));
+}
+
+static bool pax_records(const char *data, size_t size,
+			char **pathp, u_int64_t *sizep)
+/* pick the path and size out of a pax extended header; false if it's bad */
+{
+    const char	*cp = data, *end = data + size;
+
+    /* the data isn't NUL-terminated, so nothing may look past end */
+    while (cp < end && *cp != '\0')
     {
-	FILE	*fp = fopen(file, "r");
-	char	buf[BUFSIZ], *cp;
-	int	printable = 0;
+	const char	*key = cp, *value, *next;
+	size_t		len = 0;
+
+	/* each record is "length key=value\n", its length counting all of it */
+	while (key < end && *key >= '0' && *key <= '9' && len <= size)
+	    len = len * 10 + (*key++ - '0');
+	if (key == cp || key >= end || *key++ != ' '
+	    || len > (size_t)(end - cp) || cp + len <= key)
+	    return(false);
+	next = cp + len;
+	if (next[-1] != '\n'
+	    || (value = memchr(key, '=', next - 1 - key)) == NULL)
+	    return(false);
+	value++;
+	if (value - key == 5 && !memcmp(key, "path=", 5))
+	{
+	    free(*pathp);
+	    *pathp = strndup(value, next - 1 - value);
+	}
+	else if (value - key == 5 && !memcmp(key, "size=", 5))
+	{
+	    *sizep = 0;
+	    for (; value < next - 1 && *value >= '0' && *value <= '9'; value++)
+		*sizep = *sizep * 10 + (*value - '0');
+	}
+	cp = next;
+    }
+    return(true);
+}
+
+static bool zero_block(const unsigned char *hp)
+/* is this one of the all-zero blocks that end an archive? */
+{
+    int		i;
+
+    for (i = 0; i < TAR_BLOCK; i++)
+	if (hp[i])
+	    return(false);
+    return(true);
+}
+
+static int namecmp(const void *a, const void *b)
+/* order members by name */
+{
+    return(strcmp(((const struct member_t *)a)->name,
+		  ((const struct member_t *)b)->name));
+}
+
+static int membercmp(const void *a, const void *b)
+/* order members by name, and by position among namesakes */
+{
+    const struct member_t *s = a, *t = b;
+    int		cmp = strcmp(s->name, t->name);
 
-	if (!fp || !fgets(buf, sizeof(buf)-1, fp))
-	    return(0);
-	fclose(fp);
+    return(cmp ? cmp : s->seq - t->seq);
+}
 
-	/* count printables */
-	for (cp = buf; *cp; cp++)
-	    if (isgraph(*cp) || isspace(*cp))
-		printable++;
+static bool load_tarball(int dirfd, const char *tree, struct archive_t *ap)
+/* map or read a whole archive, returning false if it can't be opened */
+{
+    struct stat	sb;
+    int		fd;
+
+    if (!strcmp(tree, "-"))
+	fd = dup(STDIN_FILENO);
+    else
+	fd = openat(dirfd, tree, O_RDONLY);
+    if (fd == -1 || fstat(fd, &sb) == -1)
+	return(false);
+    ap->base = NULL;
+    ap->size = 0;
+    ap->mapped = false;
+    if (S_ISREG(sb.st_mode) && sb.st_size > 0)
+    {
+	ap->base = mmap(NULL, sb.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (ap->base != MAP_FAILED)
+	{
+	    ap->size = sb.st_size;
+	    ap->mapped = true;
+	    (void)madvise(ap->base, ap->size, MADV_SEQUENTIAL);
+	}
+	else
+	    ap->base = NULL;
+    }
+    if (!ap->mapped)
+    {
+	size_t	alloc = 1 << 20;
+	ssize_t	n;
 
-	/* are we over the critical percentage? */
-	return (printable >= MIN_PRINTABLE * strlen(buf));
+	if ((ap->base = malloc(alloc)) == NULL)
+	{
+	    fprintf(stderr, "comparator: out of memory reading %s\n", tree);
+	    exit(1);
+	}
+	while ((n = read(fd, ap->base + ap->size, alloc - ap->size)) != 0)
+	{
+	    if (n == -1)
+	    {
+		fprintf(stderr, "comparator: can't read %s, %s\n",
+			tree, strerror(errno));
+		exit(1);
+	    }
+	    if ((ap->size += n) == alloc
+		&& (ap->base = realloc(ap->base, alloc *= 2)) == NULL)
+	    {
+		fprintf(stderr, "comparator: out of memory reading %s\n", tree);
+		exit(1);
+	    }
+	}
     }
+    close(fd);
+    return(true);
+}
+
+static char **tarball_file_list(int dirfd, const char *tree, int *fc)
+/* list the eligible files of an archive, registering it for source_open() */
+{
+    struct archive_t *ap = (struct archive_t *)calloc(sizeof(struct archive_t), 1);
+    const unsigned char *hp;
+    char	*longname = NULL, **list;
+    u_int64_t	longsize = 0;
+    size_t	pos, alloc = 0;
+    bool	sized = false, ended = false;
+    int		i, n;
+
+    if (!load_tarball(dirfd, tree, ap))
+    {
+	free(ap);
+	return(NULL);
+    }
+    ap->root = tree_name(dirfd, tree);
+    for (pos = 0; pos + TAR_BLOCK <= ap->size; )
+    {
+	char	name[TAR_BLOCK];
+	u_int64_t	size;
+	int	type;
+
+	hp = (const unsigned char *)ap->base + pos;
+	if (zero_block(hp))
+	{
+	    /* two of them end it, though some writers stop after one */
+	    ended = (pos + 2 * TAR_BLOCK > ap->size
+		     || zero_block(hp + TAR_BLOCK));
+	    break;
+	}
+	if (!tar_header(hp))
+	{
+	    if (pos == 0)
+		fprintf(stderr, "comparator: %s is not a tar archive.\n", tree);
+	    else
+		fprintf(stderr, "comparator: %s is damaged at byte %lu.\n",
+			tree, (unsigned long)pos);
+	    exit(1);
+	}
+	type = hp[156];
+	size = tar_number(hp + 124, 12);
+	if (sized && type != 'L' && type != 'x')
+	    size = longsize;
+	pos += TAR_BLOCK;
+	if (size > ap->size - pos)
+	{
+	    fprintf(stderr, "comparator: %s is truncated.\n", tree);
+	    exit(1);
+	}
+
+	/* these describe the next header rather than being members */
+	if (type == 'L')
+	{
+	    free(longname);
+	    longname = strndup(ap->base + pos, size);
+	}
+	else if (type == 'x')
+	{
+	    if (!pax_records(ap->base + pos, size, &longname, &longsize))
+	    {
+		fprintf(stderr, "comparator: %s is damaged at byte %lu.\n",
+			tree, (unsigned long)pos);
+		exit(1);
+	    }
+	    sized = (longsize > 0);
+	}
+	else if (type == '\0' || type == '0' || type == '7')
+	{
+	    char	*cp = name, *path;
+
+	    if (longname)
+		cp = longname;
+	    else if (hp[345] && !memcmp(hp + 257, "ustar", 6))
+		snprintf(name, sizeof(name), "%.155s/%.100s",
+			 (const char *)hp + 345, (const char *)hp);
+	    else
+		snprintf(name, sizeof(name), "%.100s", (const char *)hp);
+	    while (*cp == '/' || !strncmp(cp, "./", 2))
+		cp += (*cp == '/') ? 1 : 2;
+	    path = malloc(strlen(ap->root) + strlen(cp) + 2);
+	    sprintf(path, "%s/%s", ap->root, cp);
+	    /* the same tests the walk makes of a file on disk */
+	    if (!*cp || size == 0 || eligible_name(path) == INELIGIBLE)
+		free(path);
+	    else
+	    {
+		struct member_t *mp;
+
+		if (ap->nmembers >= alloc)
+		{
+		    alloc = 2 * alloc + 64;
+		    ap->members = (struct member_t *)realloc(ap->members,
+					sizeof(struct member_t) * alloc);
+		}
+		mp = ap->members + ap->nmembers;
+		mp->name = path;
+		mp->data = ap->base + pos;
+		mp->size = size;
+		mp->seq = ap->nmembers++;
+	    }
+	}
+	if (type != 'L' && type != 'x')
+	{
+	    free(longname);
+	    longname = NULL;
+	    sized = false;
+	    longsize = 0;
+	}
+	pos += (size + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    }
+    free(longname);
+    if (!ended || ap->size % TAR_BLOCK)
+    {
+	fprintf(stderr, "comparator: %s is truncated.\n", tree);
+	exit(1);
+    }
+
+    /* as when extracting, a later copy of a file replaces an earlier one */
+    qsort(ap->members, ap->nmembers, sizeof(struct member_t), membercmp);
+    for (i = n = 0; i < ap->nmembers; i++)
+	if (i + 1 < ap->nmembers
+	    && !strcmp(ap->members[i].name, ap->members[i + 1].name))
+	    free(ap->members[i].name);
+	else
+	    ap->members[n++] = ap->members[i];
+    ap->nmembers = n;
+
+    /* caller is responsible for freeing this */
+    list = (char **)calloc(sizeof(char *), n + 1);
+    for (i = 0; i < n; i++)
+	list[i] = strdup(ap->members[i].name);
+    *fc = n;
+
+    pthread_mutex_lock(&archive_lock);
+    ap->next = archives;
+    archives = ap;
+    pthread_mutex_unlock(&archive_lock);
+    return(list);
+}
+
+static bool tar_member(const char *file, struct source_t *src)
+/* point a source at a file in a loaded archive, if it's named for one */
+{
+    struct archive_t *ap;
+    struct member_t key, *mp = NULL;
+    bool	inside = false;
+
+    /*
+     * Roots may nest, as those of a.tar and a/b.tar do, so every
+     * archive whose root the name is under gets a look.  An archive
+     * is only released once its files are all shredded.
+     */
+    key.name = (char *)file;
+    pthread_mutex_lock(&archive_lock);
+    for (ap = archives; ap && mp == NULL; ap = ap->next)
+    {
+	size_t	n = strlen(ap->root);
+
+	if (!strncmp(file, ap->root, n) && file[n] == '/')
+	{
+	    inside = true;
+	    mp = bsearch(&key, ap->members, ap->nmembers,
+			 sizeof(struct member_t), namecmp);
+	}
+    }
+    pthread_mutex_unlock(&archive_lock);
+
+    /* a name from an archive must not be looked for on disk instead */
+    if (mp == NULL && inside)
+    {
+	fprintf(stderr, "comparator: %s is in no archive loaded.\n", file);
+	exit(1);
+    }
+    if (mp == NULL)
+	return(false);
+    src->base = (char *)mp->data;
+    src->size = mp->size;
+    src->cursor = 0;
+    src->mapped = false;
+    src->borrowed = true;
+    return(true);
+}
+
+void tarball_release(const char *root)
+/* drop an archive whose files have all been shredded */
+{
+    struct archive_t **app, *ap;
+    int		i;
+
+    pthread_mutex_lock(&archive_lock);
+    for (app = &archives; (ap = *app) != NULL; app = &ap->next)
+	if (!strcmp(ap->root, root))
+	{
+	    *app = ap->next;
+	    break;
+	}
+    pthread_mutex_unlock(&archive_lock);
+    if (ap == NULL)
+	return;
+    if (ap->mapped)
+	munmap(ap->base, ap->size);
+    else
+	free(ap->base);
+    for (i = 0; i < ap->nmembers; i++)
+	free(ap->members[i].name);
+    free(ap->members);
+    free(ap->root);
+    free(ap);
+}
+
+/*
+ * Each input file is opened and read exactly once.  The shredder works
+ * from a mapping of the whole file where it can get one and from a
+ * buffer holding the file's contents where it can't.
+ */
+
+bool source_open(struct source_t *src, int dirfd, const char *file)
+/* load the contents of a file relative to dirfd, returning false on failure */
+{
+    struct stat	sb;
+    int		fd;
+
+    if (tar_member(file, src))
+	return(true);
+    src->borrowed = false;
+    if ((fd = openat(dirfd, file, O_RDONLY)) == -1)
+	return(false);
+    if (fstat(fd, &sb) == -1)
+    {
+	close(fd);
+	return(false);
+    }
+    src->size = sb.st_size;
+    src->cursor = 0;
+    src->mapped = false;
+    src->base = NULL;
+    if (src->size > 0)
+    {
+	src->base = mmap(NULL, src->size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (src->base != MAP_FAILED)
+	{
+	    src->mapped = true;
+	    (void)madvise(src->base, src->size, MADV_SEQUENTIAL);
+	}
+	else
+	{
+	    size_t	got = 0;
+	    ssize_t	n;
+
+	    if ((src->base = malloc(src->size)) == NULL)
+	    {
+		fprintf(stderr, "comparator: out of memory reading %s\n", file);
+		exit(1);
+	    }
+	    while (got < src->size
+		   && (n = read(fd, src->base + got, src->size - got)) > 0)
+		got += n;
+	    src->size = got;
+	}
+    }
+    close(fd);
+    COUNT(bytes_read, src->size);
+    return(true);
+}
+
+char *source_gets(char *buf, int size, struct source_t *src)
+/* fgets(3) workalike that reads from a loaded source */
+{
+    const char	*start = src->base + src->cursor, *nl;
+    size_t	len = src->size - src->cursor;
+
+    if (len == 0 || size < 2)
+	return(NULL);
+    if (len > size - 1)
+	len = size - 1;
+    if ((nl = memchr(start, '\n', len)))
+	len = nl - start + 1;
+    memcpy(buf, start, len);
+    buf[len] = '\0';
+    src->cursor += len;
+    return(buf);
+}
+
+void source_close(struct source_t *src)
+/* release a loaded source */
+{
+    if (src->borrowed)
+	;			/* the archive it's in is released whole */
+    else if (src->mapped)
+	munmap(src->base, src->size);
+    else
+	free(src->base);
+    src->base = NULL;
 }
 
 typedef struct
 {
     char	*feature;
+    int		length;		/* of the feature, taken once on entry */
     linenum_t  	start;
     flag_t	flags;
 }
 shred;
 
-static struct hash_t emit_chunk(shred *display, int linecount) 
-/* emit chunk corresponding to current display */
+/*
+ * A window of shreds is a ring of shredsize slots, the oldest at
+ * index first, so a new line costs no shifting.  Hashing a window is
+ * the innermost loop of shredding; emit_window() is inlined with the
+ * size as a constant for the usual shred sizes, so those loops unroll
+ * and the ring index needs no division, and is left a variable for
+ * any other -s.
+ */
+#define RING(first, i, size)	((first) + (i) < (size) ? (first) + (i) : (first) + (i) - (size))
+
+static inline struct hash_t emit_window(const shred *ring, int first,
+					const int size, linenum_t linecount)
+/* hash the window of size shreds starting at ring[first] */
 {
-    int  		i, firstindex;
+    int  		i;
     struct hash_t	out;
 
-    /* build completed chunk onto end of array */
     out.flags = 0;
+    out.start = 0;
     hash_init();
-    firstindex = shredsize;
-    for (i = shredsize - 1; i >= 0; i--)
-	if (display[i].feature)
-	    firstindex = i;
-    firstindex = display[firstindex].start;
+    for (i = size - 1; i >= 0; i--)
+	if (ring[RING(first, i, size)].feature)
+	    out.start = ring[RING(first, i, size)].start;
     if (debug)
-	fprintf(stderr, "Chunk at line %d:\n", firstindex);
-    for (i = 0; i < shredsize; i++)
-	if (display[i].feature)
+	fprintf(stderr, "Chunk at line %u:\n", out.start);
+    for (i = 0; i < size; i++)
+    {
+	const shred *sp = ring + RING(first, i, size);
+
+	if (sp->feature)
 	{
 	    if (debug)
-		fprintf(stderr, "%d (%02x): '%s'\n", i, display[i].flags, display[i].feature);
-	    hash_update((unsigned char*) display[i].feature, strlen(display[i].feature));
-	    out.flags |= display[i].flags;
+		fprintf(stderr, "%d (%02x): '%s'\n", i, sp->flags, sp->feature);
+	    hash_update((unsigned char*) sp->feature, sp->length);
+	    COUNT_HERE(bytes_hashed, sp->length);
+	    out.flags |= sp->flags;
 	}
+    }
     hash_complete(&out.hash);
-    out.start = firstindex;
+    COUNT_HERE(shreds_generated, 1);
     out.end = linecount;
 
     return(out);
 }
 
-int shredfile(struct filehdr_t *file, 
-		      void (*hook)(struct hash_t, struct filehdr_t *))
-/* emit hash section for specified file */
+static struct hash_t emit_chunk(const shred *ring, int first, linenum_t linecount)
+/* emit chunk corresponding to the current window */
 {
-    FILE *fp;
-    int i, accepted;
-    linenum_t	linenumber;
-    shred *display;
-    feature_t *feature;
+    switch (shredsize)
+    {
+    case 3:
+	return(emit_window(ring, first, 3, linecount));
+    case 5:
+	return(emit_window(ring, first, 5, linecount));
+    case 10:
+	return(emit_window(ring, first, 10, linecount));
+    default:
+	return(emit_window(ring, first, shredsize, linecount));
+    }
+}
+
+static void add_chunk(struct chunklist_t *out, struct hash_t hash)
+/* append a hash to a file's chunk list */
+{
+    if (out->count >= out->alloc)
+    {
+	out->alloc = 2*out->alloc + 1;
+	out->chunks = (struct hash_t *)realloc(out->chunks, 
+			  sizeof(struct hash_t) * out->alloc);
+	COUNT(reallocs, 1);
+    }
+    out->chunks[out->count++] = hash;
+}
+
+static bool load_source(int dirfd, const char *name, struct source_t *src)
+/* load a file to be shredded, returning false if it's ineligible */
+{
+    bool sniff = (eligible_name(name) == SNIFF);
 
-    if ((fp = fopen(file->name, "r")) == NULL)
+    if (!source_open(src, dirfd, name))
     {
+	/* a file we'd have had to sniff is one we can quietly skip */
+	if (sniff)
+	    return(false);
 	fprintf(stderr, "shredtree: couldn't open %s, error %d\n",
-		file->name, errno);
+		name, errno);
 	exit(1);
     }
+    if (sniff && !eligible_text(src->base, src->size))
+    {
+	source_close(src);
+	return(false);
+    }
+    return(true);
+}
+
+/*
+ * A file is shredded as one or more segments, each a run of whole lines.
+ * The shreds lying wholly inside a segment are made by whichever thread
+ * takes it; the first and last few features of each segment are kept
+ * back so that the shreds straddling segment boundaries can be made
+ * when the pieces are stitched together.  The result is exactly the
+ * chunk sequence a single pass over the file would give.  Small files
+ * are one segment; big ones are split so several threads can share
+ * them when there are threads to spare.
+ */
 
-    /* deduce what filtering type we should use */
-#define endswith(suff) !strcmp(suff,file->name+strlen(file->name)-strlen(suff))
-    linebyline.mode(0);
+#define SEGMENT_SIZE	(256 << 10)	/* bytes per segment of a big file */
+
+struct segment_t
+{
+    struct source_t	src;		/* this segment's part of the file */
+    linenum_t		firstline;	/* lines before the segment */
+    int			mode;		/* analyzer mode at its start */
+    int			variant;	/* normalization it's shredded under */
+    shred		*head, *tail;	/* first and last shredsize-1 features */
+    int			nkept;		/* features in each of head and tail */
+    int			accepted;	/* features in the segment */
+    linenum_t		lastline;	/* line count at its end */
+    struct chunklist_t	chunks;		/* shreds wholly inside it */
+};
+
+static int file_mode(const char *name)
+/* deduce what filtering type we should use */
+{
+#define endswith(suff) !strcmp(suff, name + strlen(name) - strlen(suff))
     if (endswith(".c") || endswith(".cc") || endswith(".h"))
-	linebyline.mode(C_CODE);
+	return(C_CODE);
     else if (endswith(".sh"))
-	linebyline.mode(SHELL_CODE);
+	return(SHELL_CODE);
+    else
+	return(0);
 #undef endswith
+}
 
-    display = (shred *)calloc(sizeof(shred), shredsize);
+static int plan_segments(const char *name, struct source_t *src, 
+			 bool split, int nvariants, struct segment_t **segsp)
+/* divide a loaded file into segments for each normalization */
+{
+    struct segment_t *segs;
+    struct filehdr_t file;
+    struct source_t first;
+    feature_t *feature;
+    linenum_t	linenumber;
+    size_t	pos, next, lines;
+    int		i, n, v, alloc, mode = file_mode(name);
+
+    alloc = split ? src->size / SEGMENT_SIZE + 1 : 1;
+    segs = (struct segment_t *)calloc(sizeof(struct segment_t), 
+				      alloc * nvariants);
+    segs[0].src = *src;
+    segs[0].mode = mode;
+    n = 1;
+    if (!split)
+    {
+	for (v = 1; v < nvariants; v++)
+	{
+	    segs[v] = segs[0];
+	    segs[v].variant = v;
+	}
+	*segsp = segs;
+	return(n);
+    }
+
+    /* 
+     * Cut at line starts about SEGMENT_SIZE apart, counting lines the
+     * way source_gets() will return them.  There's no point cutting
+     * beyond the last line the analyzer will accept.
+     */
+    lines = 0;
+    next = SEGMENT_SIZE;
+    for (pos = 0; pos < src->size; )
+    {
+	const char *nl = memchr(src->base + pos, '\n', src->size - pos);
+	size_t	len = nl ? nl - (src->base + pos) + 1 : src->size - pos;
+
+	lines += (len + BUFSIZ - 2) / (BUFSIZ - 1);
+	pos += len;
+	if (lines >= MAX_LINENUM - 1)
+	    break;
+	if (pos >= next && pos < src->size && n < alloc)
+	{
+	    segs[n].src.base = src->base + pos;
+	    segs[n].firstline = lines;
+	    n++;
+	    next = pos + SEGMENT_SIZE;
+	}
+    }
+    for (i = 0; i < n; i++)
+    {
+	struct source_t *sp = &segs[i].src;
+
+	sp->size = ((i + 1 < n) ? segs[i + 1].src.base 
+		    : src->base + src->size) - sp->base;
+	sp->cursor = 0;
+	sp->mapped = false;
+    }
+
+    /*
+     * A #! line naming a shell changes the mode for the whole file.
+     * Whether the analyzer sees it depends on the normalization, so
+     * each one gets its own look.
+     */
+    for (v = 0; v < nvariants; v++)
+    {
+	struct segment_t *vp = segs + v * n;
+
+	if (v > 0)
+	    memcpy(vp, segs, sizeof(struct segment_t) * n);
+	for (i = 0; i < n; i++)
+	    vp[i].variant = v;
+	if (n == 1)
+	    continue;
+
+	/* segments start after a newline, so the first has one */
+	first = *src;
+	first.size = (char *)memchr(src->base, '\n', segs[0].src.size)
+	    - src->base + 1;
+	if (first.size > BUFSIZ - 1)
+	    first.size = BUFSIZ - 1;
+	first.cursor = 0;
+	file.name = (char *)name;
+	linebyline.select(v);
+	linebyline.mode(mode);
+	if ((feature = linebyline.get(&file, &first, &linenumber)))
+	    linebyline.free(feature->text);
+	for (i = 1; i < n; i++)
+	    vp[i].mode = linebyline.current();
+    }
+
+    *segsp = segs;
+    return(n);
+}
 
-    linenumber = accepted = 0;
-    while ((feature = linebyline.get(file, fp, &linenumber)))
+static void shred_segment(const char *name, struct segment_t *sp)
+/* generate the shreds lying wholly inside one segment of a file */
+{
+    int i, accepted, first, last;
+    linenum_t	linenumber;
+    shred *ring;
+    feature_t *feature;
+    struct filehdr_t file;
+
+    file.name = (char *)name;
+    linebyline.select(sp->variant);
+    linebyline.resume(sp->mode, sp->firstline);
+
+    ring = (shred *)calloc(sizeof(shred), shredsize);
+    sp->head = (shred *)calloc(sizeof(shred), shredsize);
+    sp->tail = (shred *)calloc(sizeof(shred), shredsize);
+
+    linenumber = sp->firstline;
+    accepted = first = 0;
+    last = shredsize - 1;
+    while ((feature = linebyline.get(&file, &sp->src, &linenumber)))
     {
 	accepted++;
 
-	/* create new shred */
-	display[shredsize-1].feature = feature->text;
-	display[shredsize-1].start = linenumber;
-	display[shredsize-1].flags = feature->flags;
+	/* create new shred in the free slot behind the oldest */
+	ring[last].feature = feature->text;
+	ring[last].length = strlen(feature->text);
+	ring[last].start = linenumber;
+	ring[last].flags = feature->flags;
+	if (accepted < shredsize)
+	    sp->head[accepted-1] = ring[last];
 
 	/* flush completed chunk */
 	if (accepted >= shredsize)
-	    hook(emit_chunk(display, linenumber), file);
-
-	/* shreds in progress are shifted down */
-	linebyline.free(display[0].feature);
-	for (i=1; i < shredsize; i++)
-	    display[i-1] = display[i];
-	display[shredsize-1].feature = NULL;
-	display[shredsize-1].flags = 0;
-    }
-    if (accepted && accepted < shredsize)
-	hook(emit_chunk(display, linenumber), file);
-    else if (accepted)
+	    add_chunk(&sp->chunks, emit_chunk(ring, first, linenumber));
+
+	/* the oldest shred leaves the window, unless it is in the head */
+	if (accepted - shredsize + 1 >= shredsize)
+	    linebyline.free(ring[first].feature);
+	ring[first].feature = NULL;
+	ring[first].flags = 0;
+	last = first;
+	if (++first == shredsize)
+	    first = 0;
+    }
+
+    sp->accepted = accepted;
+    sp->nkept = (accepted < shredsize - 1) ? accepted : shredsize - 1;
+    for (i = 0; i < sp->nkept; i++)
+	sp->tail[i] = ring[RING(first, shredsize - 1 - sp->nkept + i, shredsize)];
+    sp->lastline = linenumber;
+    free(ring);
+}
+
+static int stitch_segments(struct segment_t *segs, int nsegs,
+			   struct chunklist_t *out)
+/* join the shreds of a file's segments, returning its line count */
+{
+    shred *window, *display;
+    int		i, j, k, nwindow, total;
+    linenum_t	lastline = segs[nsegs-1].lastline;
+
+    window = (shred *)calloc(sizeof(shred), 2 * shredsize);
+    display = (shred *)calloc(sizeof(shred), shredsize);
+    nwindow = total = 0;
+    for (i = 0; i < nsegs; i++)
+    {
+	struct segment_t *sp = segs + i;
+
+	/* shreds ending early in this segment and starting before it */
+	for (j = 0; j < sp->nkept; j++)
+	    if (total + j + 1 >= shredsize)
+	    {
+		int	before = shredsize - 1 - j;
+
+		for (k = 0; k < before; k++)
+		    display[k] = window[nwindow - before + k];
+		for (k = 0; k <= j; k++)
+		    display[before + k] = sp->head[k];
+		add_chunk(out, emit_chunk(display, 0, sp->head[j].start));
+	    }
+
+	/* then the ones wholly inside it */
+	if (out->count == 0)
+	{
+	    *out = sp->chunks;
+	    sp->chunks.chunks = NULL;
+	}
+	else if (sp->chunks.count)
+	{
+	    if (out->count + sp->chunks.count > out->alloc)
+	    {
+		out->alloc = out->count + sp->chunks.count;
+		out->chunks = (struct hash_t *)realloc(out->chunks,
+				  sizeof(struct hash_t) * out->alloc);
+		COUNT(reallocs, 1);
+	    }
+	    memcpy(out->chunks + out->count, sp->chunks.chunks,
+		   sizeof(struct hash_t) * sp->chunks.count);
+	    out->count += sp->chunks.count;
+	}
+
+	/* keep the last shredsize-1 features seen for the next segment */
+	for (j = 0; j < sp->nkept; j++)
+	    window[nwindow++] = sp->tail[j];
+	if (nwindow > shredsize - 1)
+	{
+	    memmove(window, window + nwindow - (shredsize - 1),
+		    sizeof(shred) * (shredsize - 1));
+	    nwindow = shredsize - 1;
+	}
+	total += sp->accepted;
+    }
+
+    if (total >= shredsize)
+    {
 	/*
 	 * What this is for is to include trailing C } lines in chunk
 	 * listings even though we're ignoring them for comparison 
@@ -174,11 +954,376 @@ int shredfile(struct filehdr_t *file,
 	 * styles).  This is a kluge, but it means we will capture
 	 * entire C functions that differ only by brace placement.
 	 */
-	extend_current_chunk(linenumber);
+	out->chunks[out->count - 1].end = lastline;
+    }
+    else if (total)
+    {
+	for (k = 0; k < shredsize; k++)
+	    display[k].feature = NULL;
+	for (k = 0; k < nwindow; k++)
+	    display[k] = window[k];
+	add_chunk(out, emit_chunk(display, 0, lastline));
+    }
 
+    /* the kept features are all that's left to free */
+    for (i = 0; i < nsegs; i++)
+    {
+	struct segment_t *sp = segs + i;
+
+	for (j = 0; j < sp->nkept; j++)
+	    if (j < sp->accepted - sp->nkept)
+		linebyline.free(sp->head[j].feature);
+	for (j = 0; j < sp->nkept; j++)
+	    linebyline.free(sp->tail[j].feature);
+	free(sp->head);
+	free(sp->tail);
+	free(sp->chunks.chunks);
+    }
+    free(window);
     free(display);
-    fclose(fp);
-    return(linenumber);
+    return(lastline);
+}
+
+/*
+ * Winnowing (Schleimer, Wilkerson and Aiken) keeps only the least hash
+ * of every window of w consecutive shreds, the rightmost on ties, so any
+ * run of w + shredsize - 1 accepted lines common to two files still has
+ * a kept shred in common, while there are several times fewer shreds to
+ * sort and reduce.  Each kept shred's range is stretched to the end of
+ * the last shred of its window, so the kept shreds of a common passage
+ * overlap and collapse_ranges() joins them into one span as before; a
+ * span may overrun the common text by less than a window at its end.
+ */
+static void winnow_chunks(struct chunklist_t *out)
+/* reduce a file's chunk list to its winnowed fingerprints */
+{
+    struct hash_t	*cp = out->chunks;
+    int		n = out->count, kept = 0, reach, r, i, m = -1, last = -1;
+
+    if (winnow <= 1 || n == 0)
+	return;
+    reach = (shredsize > 1) ? winnow - 1 : winnow;
+    for (r = ((n < winnow) ? n : winnow) - 1; r < n; r++)
+    {
+	int	lo = (r - winnow + 1 > 0) ? r - winnow + 1 : 0;
+
+	if (m < lo)
+	{
+	    /* the minimum left the window; look for the new one */
+	    for (m = lo, i = lo + 1; i <= r; i++)
+		if (hash_compare(cp[i].hash, cp[m].hash) <= 0)
+		    m = i;
+	}
+	else if (hash_compare(cp[r].hash, cp[m].hash) <= 0)
+	    m = r;
+	if (m != last)
+	{
+	    /* kept shreds go below m, where no window looks any more */
+	    struct hash_t	this = cp[m];
+
+	    this.end = cp[(m + reach < n) ? m + reach : n - 1].end;
+	    cp[kept++] = this;
+	    last = m;
+	}
+    }
+    COUNT(dropped_winnow, n - kept);
+    out->count = kept;
+}
+
+/*************************************************************************
+ *
+ * The shredding pipeline
+ *
+ *************************************************************************/
+
+/*
+ * Reader threads load files, shredder threads turn them into hash
+ * lists, and the calling thread hands finished files to the consumer
+ * in list order.  Readers stay within a window of files ahead of the
+ * consumer and a budget of loaded bytes, so memory use stays bounded
+ * however big the tree.  io_uring would save the reader threads, but
+ * they are portable and keep the disk busy just as well.
+ */
+
+int shred_threads = 0;		/* 0 means one per CPU */
+
+#define PIPE_WINDOW	256		/* files in flight */
+#define PIPE_BUDGET	(64 << 20)	/* bytes of loaded text in flight */
+
+enum {QUEUED, LOADING, LOADED, PLANNING, SHREDDING, DONE};
+
+struct job_t
+{
+    char	*name;
+    int		state;
+    struct source_t src;
+    struct segment_t *segs;	/* nsegs for each normalization in turn */
+    int		nsegs;
+    int		next_seg;	/* first segment no shredder has claimed */
+    int		segs_done;
+    int		lines;		/* -1 if the file turned out ineligible */
+    struct chunklist_t *out;	/* one list per normalization */
+};
+
+struct pipeline_t
+{
+    pthread_mutex_t	lock;
+    pthread_cond_t	wakeup;
+    int			dirfd;		/* file names are relative to this */
+    struct job_t	*jobs;
+    int			count;
+    int			nshredders;
+    int			nvariants;	/* normalizations to shred under */
+    int			next_read;	/* first file no reader has claimed */
+    int			next_write;	/* first file not yet consumed */
+    size_t		inflight;	/* bytes loaded but not shredded */
+};
+
+static void prefetch(struct source_t *src)
+/* fault in a mapped file so the shredder doesn't wait on the disk */
+{
+    volatile char sink = 0;
+    size_t	off;
+    long	pagesize = sysconf(_SC_PAGESIZE);
+
+    if (!src->mapped)
+	return;
+    (void)madvise(src->base, src->size, MADV_WILLNEED);
+    for (off = 0; off < src->size; off += pagesize)
+	sink += src->base[off];
+}
+
+static void *reader(void *arg)
+/* reader thread: load files in list order */
+{
+    struct pipeline_t *pp = (struct pipeline_t *)arg;
+
+    pthread_mutex_lock(&pp->lock);
+    for (;;)
+    {
+	struct job_t *jp;
+	bool	loaded;
+
+	while (pp->next_read < pp->count
+	       && pp->next_read != pp->next_write
+	       && (pp->next_read >= pp->next_write + PIPE_WINDOW
+		   || pp->inflight >= PIPE_BUDGET))
+	    pthread_cond_wait(&pp->wakeup, &pp->lock);
+	if (pp->next_read >= pp->count)
+	    break;
+	jp = pp->jobs + pp->next_read++;
+	jp->state = LOADING;
+	pthread_mutex_unlock(&pp->lock);
+
+	if ((loaded = load_source(pp->dirfd, jp->name, &jp->src)))
+	    prefetch(&jp->src);
+
+	pthread_mutex_lock(&pp->lock);
+	if (loaded)
+	{
+	    jp->state = LOADED;
+	    pp->inflight += jp->src.size;
+	}
+	else
+	{
+	    jp->lines = -1;
+	    jp->state = DONE;
+	}
+	pthread_cond_broadcast(&pp->wakeup);
+    }
+    pthread_mutex_unlock(&pp->lock);
+    return(NULL);
+}
+
+static void *shredder(void *arg)
+/* shredder thread: work on whatever loaded file is earliest in the list */
+{
+    struct pipeline_t *pp = (struct pipeline_t *)arg;
+
+    pthread_mutex_lock(&pp->lock);
+    for (;;)
+    {
+	struct job_t *jp = NULL;
+	struct segment_t *segs;
+	bool	pending = (pp->next_read < pp->count);
+	int	i, n;
+
+	for (i = pp->next_write; i < pp->next_read; i++)
+	{
+	    struct job_t *tp = pp->jobs + i;
+
+	    if (tp->state == LOADED
+		|| (tp->state == SHREDDING 
+		    && tp->next_seg < tp->nsegs * pp->nvariants))
+	    {
+		jp = tp;
+		break;
+	    }
+	    else if (tp->state == LOADING || tp->state == PLANNING)
+		pending = true;
+	}
+	if (jp == NULL)
+	{
+	    if (!pending)
+		break;
+	    pthread_cond_wait(&pp->wakeup, &pp->lock);
+	    continue;
+	}
+
+	if (jp->state == LOADED)
+	{
+	    /* split big files if there are other threads to help */
+	    jp->state = PLANNING;
+	    pthread_mutex_unlock(&pp->lock);
+	    n = plan_segments(jp->name, &jp->src, 
+			      pp->nshredders > 1 
+			      && jp->src.size >= 2 * SEGMENT_SIZE, 
+			      pp->nvariants, &segs);
+	    pthread_mutex_lock(&pp->lock);
+	    jp->segs = segs;
+	    jp->nsegs = n;
+	    jp->state = SHREDDING;
+	    if (n * pp->nvariants > 1)
+		pthread_cond_broadcast(&pp->wakeup);
+	    continue;
+	}
+
+	i = jp->next_seg++;
+	pthread_mutex_unlock(&pp->lock);
+	phase_begin(PHASE_SHRED);
+	shred_segment(jp->name, jp->segs + i);
+	flush_counts();
+	phase_end(PHASE_SHRED);
+	pthread_mutex_lock(&pp->lock);
+	if (++jp->segs_done < jp->nsegs * pp->nvariants)
+	    continue;
+
+	/* whoever finishes the last segment puts the file together */
+	pthread_mutex_unlock(&pp->lock);
+	phase_begin(PHASE_SHRED);
+	for (i = 0; i < pp->nvariants; i++)
+	{
+	    jp->lines = stitch_segments(jp->segs + i * jp->nsegs, jp->nsegs,
+					jp->out + i);
+	    winnow_chunks(jp->out + i);
+	}
+	flush_counts();
+	phase_end(PHASE_SHRED);
+	free(jp->segs);
+	source_close(&jp->src);
+
+	pthread_mutex_lock(&pp->lock);
+	pp->inflight -= jp->src.size;
+	jp->state = DONE;
+	pthread_cond_broadcast(&pp->wakeup);
+    }
+    pthread_mutex_unlock(&pp->lock);
+    return(NULL);
+}
+
+void shred_files(int dirfd, char **list, int count, int nvariants,
+		 void (*consume)(void *, const char *, int, struct chunklist_t *),
+		 void *arg)
+/* shred a list of files, passing each one's results to consume() in order */
+{
+    struct pipeline_t pl;
+    pthread_t	*threads;
+    int		i, j, nshredders, nreaders, nthreads, started[2] = {0, 0};
+
+    nshredders = shred_threads;
+    if (nshredders <= 0)
+	nshredders = sysconf(_SC_NPROCESSORS_ONLN);
+    if (nshredders <= 0 || debug)	/* keep debug output in order */
+	nshredders = 1;
+    nreaders = 2 + nshredders / 4;
+
+    pthread_mutex_init(&pl.lock, NULL);
+    pthread_cond_init(&pl.wakeup, NULL);
+    pl.dirfd = dirfd;
+    pl.nshredders = nshredders;
+    pl.nvariants = nvariants;
+    pl.jobs = (struct job_t *)calloc(sizeof(struct job_t), count + 1);
+    pl.count = count;
+    pl.next_read = pl.next_write = 0;
+    pl.inflight = 0;
+    for (i = 0; i < count; i++)
+    {
+	pl.jobs[i].name = list[i];
+	pl.jobs[i].out = (struct chunklist_t *)calloc(sizeof(struct chunklist_t),
+						      nvariants);
+    }
+
+    threads = (pthread_t *)malloc(sizeof(pthread_t) * (nreaders + nshredders));
+    nthreads = 0;
+    for (i = 0; i < nreaders + nshredders; i++)
+	if (pthread_create(&threads[nthreads], NULL,
+			   i < nreaders ? reader : shredder, &pl) == 0)
+	{
+	    started[i >= nreaders]++;
+	    nthreads++;
+	}
+    if (!started[0] || !started[1])
+    {
+	(void)fputs("comparator: can't start shredding threads.\n", stderr);
+	exit(1);
+    }
+
+    for (i = 0; i < count; i++)
+    {
+	struct job_t *jp = pl.jobs + i;
+
+	pthread_mutex_lock(&pl.lock);
+	while (jp->state != DONE)
+	    pthread_cond_wait(&pl.wakeup, &pl.lock);
+	pthread_mutex_unlock(&pl.lock);
+
+	consume(arg, jp->name, jp->lines, jp->out);
+	for (j = 0; j < nvariants; j++)
+	    free(jp->out[j].chunks);
+	free(jp->out);
+
+	pthread_mutex_lock(&pl.lock);
+	pl.next_write = i + 1;
+	pthread_cond_broadcast(&pl.wakeup);
+	pthread_mutex_unlock(&pl.lock);
+    }
+
+    while (nthreads-- > 0)
+	pthread_join(threads[nthreads], NULL);
+    free(threads);
+    free(pl.jobs);
+    pthread_cond_destroy(&pl.wakeup);
+    pthread_mutex_destroy(&pl.lock);
+}
+
+void shred_source(const char *name, struct source_t *src, int nvariants,
+		  void (*consume)(void *, const char *, int, struct chunklist_t *),
+		  void *arg)
+/* shred text already loaded, whatever its name, and pass it to consume() */
+{
+    struct segment_t *segs;
+    struct chunklist_t *out;
+    int		i, n, lines = 0;
+
+    out = (struct chunklist_t *)calloc(sizeof(struct chunklist_t), nvariants);
+    phase_begin(PHASE_SHRED);
+    n = plan_segments(name, src, false, nvariants, &segs);
+    for (i = 0; i < n * nvariants; i++)
+	shred_segment(name, segs + i);
+    for (i = 0; i < nvariants; i++)
+    {
+	lines = stitch_segments(segs + i * n, n, out + i);
+	winnow_chunks(out + i);
+    }
+    flush_counts();
+    phase_end(PHASE_SHRED);
+    free(segs);
+    source_close(src);
+
+    consume(arg, name, lines, out);
+    for (i = 0; i < nvariants; i++)
+	free(out[i].chunks);
+    free(out);
 }
 
 /*************************************************************************
@@ -187,67 +1332,354 @@ int shredfile(struct filehdr_t *file,
  *
  *************************************************************************/
 
-static int treewalker(const char *file, const struct stat *sb, int flag)
-/* walk the tree, emitting hash sections for eligible files */
+/*
+ * The walk is done by a pool of threads, each reading whole directories
+ * off a shared queue.  Entries are sorted within their directory, using
+ * the name with a trailing / as the key for subdirectories.  A
+ * subdirectory's contents all share that key as a prefix of their paths,
+ * so a preorder traversal of the result comes out in exactly the order a
+ * strcmp() sort of the full paths would give, without doing one.
+ */
+
+#define WALK_THREADS	16	/* ftw() used to be allowed this many fds */
+
+struct entry_t
+{
+    char	*key;		/* sort key; name, plus / for directories */
+    char	*path;		/* full path of a file */
+    struct dir_t *dir;		/* contents of a directory */
+};
+
+struct devino_t
+{
+    dev_t	dev;
+    ino_t	ino;
+};
+
+struct dir_t
+{
+    char	*path;
+    struct devino_t id;
+    struct dir_t *parent;
+    struct entry_t *entries;
+    int		nentries;
+    struct dir_t *next;		/* work queue link */
+};
+
+struct walk_t		/* state of one tree walk, shared by its threads */
+{
+    pthread_mutex_t	lock;
+    pthread_cond_t	wakeup;
+    int			dirfd;	/* relative paths start here */
+    struct dir_t	*queue;
+    int			busy;	/* directories being read right now */
+    void		*seen;	/* tsearch tree of directories kept */
+};
+
+static int devinocmp(const void *a, const void *b)
+/* order directories by device and inode */
+{
+    const struct devino_t *s = a, *t = b;
+
+    if (s->dev != t->dev)
+	return (s->dev < t->dev) ? -1 : 1;
+    else if (s->ino != t->ino)
+	return (s->ino < t->ino) ? -1 : 1;
+    else
+	return(0);
+}
+
+static bool first_visit(struct walk_t *wp, const struct devino_t *id)
+/* true the first time we see a directory */
 {
-    if (flag == FTW_F && sb->st_size > 0 && eligible(file))
+    struct devino_t *new = (struct devino_t *)malloc(sizeof(struct devino_t));
+
+    *new = *id;
+    if (*(struct devino_t **)tsearch(new, &wp->seen, devinocmp) != new)
     {
-	struct item *new;
+	free(new);
+	return(false);
+    }
+    return(true);
+}
+
+static char *joinpath(const char *dir, const char *name)
+/* make the path of a directory entry the way ftw() did */
+{
+    size_t	len = strlen(dir);
+    char	*path = (char *)malloc(len + strlen(name) + 2);
+
+    strcpy(path, dir);
+    if (len == 0 || dir[len - 1] != '/')
+	path[len++] = '/';
+    strcpy(path + len, name);
+    return(path);
+}
+
+static int entrysort(const void *a, const void *b)
+/* sort comparison of directory entries by key */ 
+{
+    return strcmp(((struct entry_t *)a)->key, ((struct entry_t *)b)->key);
+}
+
+static void read_directory(struct walk_t *wp, struct dir_t *dp)
+/* list one directory, queueing its subdirectories for other threads */
+{
+    struct dirent *de;
+    struct dir_t *children = NULL, *child;
+    DIR		*dirp;
+    int		fd, alloc = 0;
 
-	new = (struct item *)malloc(sizeof(new));
-        new->file = strdup(file);
-	new->next = head;
-	head = new;
-	file_count++;
+    if ((fd = openat(wp->dirfd, dp->path, O_RDONLY | O_DIRECTORY)) == -1)
+	return;
+    if ((dirp = fdopendir(fd)) == NULL)
+    {
+	close(fd);
+	return;
     }
-    return(0);
+    while ((de = readdir(dirp)) != NULL)
+    {
+	struct entry_t *ep;
+	struct stat sb;
+	struct devino_t id;
+	char	*path;
+	bool	wanted;
+
+	if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+	    continue;
+	/* like ftw(), follow symbolic links */
+	if (fstatat(dirfd(dirp), de->d_name, &sb, 0) == -1)
+	    continue;
+	path = joinpath(dp->path, de->d_name);
+	id.dev = sb.st_dev;
+	id.ino = sb.st_ino;
+	if (S_ISDIR(sb.st_mode))
+	{
+	    struct dir_t *ap;
+
+	    /* every file under a version-control directory is ineligible */
+	    wanted = !(strstr(path, "CVS") || strstr(path, "RCS") 
+		       || strstr(path, "SCCS") || strstr(path, "SVN"));
+	    /*
+	     * A link back to a directory we're inside would never end.
+	     * Other aliases are walked, and pruned afterwards in path
+	     * order, so which one is kept doesn't depend on the threads.
+	     */
+	    for (ap = dp; ap && wanted; ap = ap->parent)
+		if (devinocmp(&ap->id, &id) == 0)
+		    wanted = false;
+	}
+	else
+	    /* files we can't judge by name get sniffed when shredded */
+	    wanted = (sb.st_size > 0 && eligible_name(path) != INELIGIBLE);
+	if (!wanted)
+	{
+	    free(path);
+	    continue;
+	}
+
+	if (dp->nentries >= alloc)
+	{
+	    alloc = 2 * alloc + 16;
+	    dp->entries = (struct entry_t *)realloc(dp->entries, 
+					sizeof(struct entry_t) * alloc);
+	}
+	ep = dp->entries + dp->nentries++;
+	if (S_ISDIR(sb.st_mode))
+	{
+	    ep->key = joinpath(de->d_name, "");
+	    ep->path = NULL;
+	    ep->dir = child = (struct dir_t *)calloc(sizeof(struct dir_t), 1);
+	    child->path = path;
+	    child->id = id;
+	    child->parent = dp;
+	    child->next = children;
+	    children = child;
+	}
+	else
+	{
+	    ep->key = path + strlen(path) - strlen(de->d_name);
+	    ep->path = path;
+	    ep->dir = NULL;
+	}
+    }
+    closedir(dirp);
+
+    qsort(dp->entries, dp->nentries, sizeof(struct entry_t), entrysort);
+
+    if (children)
+    {
+	pthread_mutex_lock(&wp->lock);
+	while ((child = children) != NULL)
+	{
+	    children = child->next;
+	    child->next = wp->queue;
+	    wp->queue = child;
+	}
+	pthread_cond_broadcast(&wp->wakeup);
+	pthread_mutex_unlock(&wp->lock);
+    }
+}
+
+static void *walker(void *arg)
+/* worker thread: read directories until there are none left */
+{
+    struct walk_t *wp = (struct walk_t *)arg;
+
+    pthread_mutex_lock(&wp->lock);
+    for (;;)
+    {
+	struct dir_t *dp;
+
+	while (wp->queue == NULL && wp->busy)
+	    pthread_cond_wait(&wp->wakeup, &wp->lock);
+	if ((dp = wp->queue) == NULL)
+	    break;
+	wp->queue = dp->next;
+	wp->busy++;
+	pthread_mutex_unlock(&wp->lock);
+
+	read_directory(wp, dp);
+
+	pthread_mutex_lock(&wp->lock);
+	if (--wp->busy == 0 && wp->queue == NULL)
+	    pthread_cond_broadcast(&wp->wakeup);
+    }
+    pthread_mutex_unlock(&wp->lock);
+    return(NULL);
 }
 
-static int stringsort(const void *a, const void *b)
-/* sort comparison of strings by content */ 
+static void discard(struct dir_t *dp)
+/* free a walked directory and everything under it */
 {
-    return strcmp(*(char **)a, *(char **)b);
+    int	i;
+
+    for (i = 0; i < dp->nentries; i++)
+	if (dp->entries[i].dir)
+	{
+	    discard(dp->entries[i].dir);
+	    free(dp->entries[i].key);
+	}
+	else
+	    free(dp->entries[i].path);
+    free(dp->entries);
+    free(dp->path);
+    free(dp);
 }
 
-char **sorted_file_list(const char *tree, int *fc)
-/* generate a sorted list of files under the given tree */
+static void prune(struct walk_t *wp, struct dir_t *dp)
+/* keep only the first, in path order, of the ways to reach a directory */
 {
-    char	**place, **list;
-#if defined(__FreeBSD__)
-    char *dirlist[2];
-    FTS *ftsptr;
-    FTSENT *entry;
-#endif
+    int	i, n;
 
-    /* make file list */
-    file_count = 0;
-#if defined(__FreeBSD__)
-    dirlist[0]= tree; dirlist[1]= NULL;
-    ftsptr= fts_open(dirlist, FTS_LOGICAL, NULL);
+    for (i = n = 0; i < dp->nentries; i++)
+    {
+	struct entry_t *ep = dp->entries + i;
 
-    /* process each entry that is a file */
-    while(1) {
-      entry= fts_read(ftsptr);
-      if (entry==NULL) break;
-      if (entry->fts_info==FTS_F) {
-	treewalker(entry->fts_accpath, entry->fts_statp, 1);
-      }
+	if (ep->dir && !first_visit(wp, &ep->dir->id))
+	{
+	    discard(ep->dir);
+	    free(ep->key);
+	    continue;
+	}
+	if (ep->dir)
+	    prune(wp, ep->dir);
+	dp->entries[n++] = *ep;
     }
-    fts_close(ftsptr);
-#else
-    ftw(tree, treewalker, 16);
-#endif
+    dp->nentries = n;
+}
 
-    /* now that we know the length, copy into an array */
-    list = place = (char **)calloc(sizeof(char *), file_count);
-    for (; head->next; head = head->next)
-	*place++ = head->file;
+static int flatten(struct dir_t *dp, char **list)
+/* collect the files of a walked tree in preorder, freeing as we go */
+{
+    int	i, count = 0;
 
-    /* the objective -- sort */
-    qsort(list, file_count, sizeof(char *), stringsort);
+    for (i = 0; i < dp->nentries; i++)
+    {
+	struct entry_t *ep = dp->entries + i;
+
+	if (ep->dir)
+	{
+	    count += flatten(ep->dir, list ? list + count : NULL);
+	    if (list)
+		free(ep->key);
+	}
+	else
+	{
+	    if (list)
+		list[count] = ep->path;
+	    count++;
+	}
+    }
+    if (list)
+    {
+	free(dp->entries);
+	free(dp->path);
+	free(dp);
+    }
+    return(count);
+}
+
+char **sorted_file_list(int dirfd, const char *tree, int *fc)
+/* generate a sorted list of files under the given tree, relative to dirfd */
+{
+    pthread_t	threads[WALK_THREADS];
+    struct walk_t walk;
+    struct stat	sb;
+    struct dir_t *root;
+    char	**list;
+    int		i, fd;
+
+    *fc = 0;
+    if (is_tarball(dirfd, tree))
+	return(tarball_file_list(dirfd, tree, fc));
+    if (fstatat(dirfd, tree, &sb, 0) == -1)
+	return(NULL);
+    if (!S_ISDIR(sb.st_mode))
+    {
+	list = (char **)calloc(sizeof(char *), 1);
+	if (sb.st_size > 0 && eligible_name(tree) != INELIGIBLE)
+	    list[(*fc)++] = strdup(tree);
+	return(list);
+    }
+    /* fail here, where errno will still tell the caller why */
+    if ((fd = openat(dirfd, tree, O_RDONLY | O_DIRECTORY)) == -1)
+	return(NULL);
+    close(fd);
+
+    root = (struct dir_t *)calloc(sizeof(struct dir_t), 1);
+    root->path = strdup(tree);
+    root->id.dev = sb.st_dev;
+    root->id.ino = sb.st_ino;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.wakeup, NULL);
+    walk.dirfd = dirfd;
+    walk.queue = root;
+    walk.busy = 0;
+    walk.seen = NULL;
+    for (i = 0; i < WALK_THREADS; i++)
+	if (pthread_create(&threads[i], NULL, walker, &walk) != 0)
+	    break;
+    if (i == 0)
+	walker(&walk);
+    while (i-- > 0)
+	pthread_join(threads[i], NULL);
+    pthread_cond_destroy(&walk.wakeup);
+    pthread_mutex_destroy(&walk.lock);
+    first_visit(&walk, &root->id);
+    prune(&walk, root);
+    while (walk.seen != NULL)
+    {
+	struct devino_t *key = *(struct devino_t **)walk.seen;
+
+	tdelete(key, &walk.seen, devinocmp);
+	free(key);
+    }
 
     /* caller is responsible for freeing this */
-    *fc = file_count;
+    *fc = flatten(root, NULL);
+    list = (char **)calloc(sizeof(char *), *fc + 1);
+    flatten(root, list);
     return(list);
 }
 
@@ -257,21 +1689,35 @@ char **sorted_file_list(const char *tree, int *fc)
  *
  *************************************************************************/
 
-static int sortchunk(const void *a, const void *b)
-/* sort by hash */
+int shred_order(const struct sorthash_t *s, const struct sorthash_t *t)
+/* the order of shreds in a sorted hash list */
 {
-    int cmp = SORTHASHCMP((struct sorthash_t *)a, (struct sorthash_t *)b);
+    int cmp = SORTHASHCMP(s, t);
 
     /*
      * Using the file name as a secondary key implies that, later on when
      * we use sort adjacency to build a duplicates list, the duplicates
      * will be ordered by filename -- thus, implicitly, by tree of origin.
+     * Line numbers break the remaining ties, so that the order doesn't
+     * depend on the sort algorithm and hash-ordered SCFs can be merged
+     * into exactly the same sequence.
      */
     if (cmp)
 	return(cmp);
+    else if ((cmp = strcmp(s->file->name, t->file->name)))
+	return(cmp);
+    else if (s->hash.start != t->hash.start)
+	return((s->hash.start < t->hash.start) ? -1 : 1);
+    else if (s->hash.end != t->hash.end)
+	return((s->hash.end < t->hash.end) ? -1 : 1);
     else
-	return(strcmp(((struct sorthash_t *)a)->file->name,
-		      ((struct sorthash_t *)b)->file->name));
+	return(0);
+}
+
+static int sortchunk(const void *a, const void *b)
+/* sort by hash */
+{
+    return(shred_order((struct sorthash_t *)a, (struct sorthash_t *)b));
 }
 
 void sort_hashes(struct sorthash_t *hashlist, int hashcount)
@@ -0,0 +1,144 @@
+/*
+ * sketch.c -- Bloom filter membership sketches of SCF hash sets
+ *
+ * A sketch answers "might this hash be in that tree?" with no false
+ * negatives, in about a byte and a half per shred.  Comparisons use
+ * the sketches of the other inputs to skip loading shreds that can't
+ * match anything outside their own tree.
+ *
+ * SPDX-License-Identifier: BSD-2-clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "shred.h"
+
+#define SKETCH_PROBES	7	/* bits set per hash */
+#define SKETCH_DENSITY	10	/* minimum bits per hash */
+
+u_int64_t hash_mix(const hashval_t *hp)
+/* fold a hash's stored bytes into 64 well-mixed bits */
+{
+    const unsigned char *cp = (const unsigned char *)hp;
+    u_int64_t	v = 0;
+    int		i;
+
+    /* the bytes are folded in a fixed order, so sketches are portable */
+    for (i = 0; i < sizeof(hashval_t); i++)
+	v ^= (u_int64_t)cp[i] << (8 * (i % 8));
+
+    /* RXOR and MD5 are both well mixed, but a finalizer costs nothing */
+    v ^= v >> 30; v *= 0xbf58476d1ce4e5b9ULL;
+    v ^= v >> 27; v *= 0x94d049bb133111ebULL;
+    v ^= v >> 31;
+    return(v);
+}
+
+static void probe_base(const hashval_t *hp, u_int64_t *h1, u_int64_t *h2)
+/* derive the probe sequence of a hash from its stored bytes */
+{
+    u_int64_t	v = hash_mix(hp);
+
+    *h1 = v & 0xffffffff;
+    *h2 = (v >> 32) | 1;
+}
+
+struct sketch_t *sketch_new(size_t nhashes)
+/* make an empty sketch big enough for the given number of hashes */
+{
+    struct sketch_t *sp = (struct sketch_t *)malloc(sizeof(struct sketch_t));
+
+    sp->probes = SKETCH_PROBES;
+    for (sp->log2bits = 6;
+	 sp->log2bits < 40 && (1ULL << sp->log2bits) < nhashes * SKETCH_DENSITY;
+	 sp->log2bits++)
+	continue;
+    sp->bits = (unsigned char *)calloc(1, SKETCH_BYTES(sp));
+    return(sp);
+}
+
+void sketch_add(struct sketch_t *sp, const hashval_t *hp)
+/* enter a hash into a sketch */
+{
+    u_int64_t	h1, h2, mask = (1ULL << sp->log2bits) - 1;
+    int		i;
+
+    probe_base(hp, &h1, &h2);
+    for (i = 0; i < sp->probes; i++)
+    {
+	u_int64_t bit = (h1 + i * h2) & mask;
+
+	sp->bits[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+bool sketch_test(const struct sketch_t *sp, const hashval_t *hp)
+/* might this hash have been entered into the sketch? */
+{
+    u_int64_t	h1, h2, mask = (1ULL << sp->log2bits) - 1;
+    int		i;
+
+    probe_base(hp, &h1, &h2);
+    for (i = 0; i < sp->probes; i++)
+    {
+	u_int64_t bit = (h1 + i * h2) & mask;
+
+	if (!(sp->bits[bit >> 3] & (1 << (bit & 7))))
+	    return(false);
+    }
+    return(true);
+}
+
+void sketch_write(const struct sketch_t *sp, FILE *fp)
+/* append a sketch to an SCF, after its statistics trailer */
+{
+    u_int32_t	probes = htonl(sp->probes), log2bits = htonl(sp->log2bits);
+
+    fwrite(sp->bits, 1, SKETCH_BYTES(sp), fp);
+    fwrite(&probes, sizeof(u_int32_t), 1, fp);
+    fwrite(&log2bits, sizeof(u_int32_t), 1, fp);
+}
+
+struct sketch_t *sketch_read(FILE *fp)
+/* read the sketch from the end of an SCF, leaving the position alone */
+{
+    struct sketch_t *sp;
+    u_int32_t	probes, log2bits;
+    long	here = ftell(fp);
+    bool	ok;
+
+    if (here == -1 || fseek(fp, -2 * (long)sizeof(u_int32_t), SEEK_END) != 0)
+	return(NULL);
+    ok = fread(&probes, sizeof(u_int32_t), 1, fp) == 1
+	&& fread(&log2bits, sizeof(u_int32_t), 1, fp) == 1;
+    probes = ntohl(probes);
+    log2bits = ntohl(log2bits);
+    if (!ok || probes == 0 || probes > 32 || log2bits < 3 || log2bits > 40)
+    {
+	fseek(fp, here, SEEK_SET);
+	return(NULL);
+    }
+
+    sp = (struct sketch_t *)malloc(sizeof(struct sketch_t));
+    sp->probes = probes;
+    sp->log2bits = log2bits;
+    sp->bits = (unsigned char *)malloc(SKETCH_BYTES(sp));
+    if (fseek(fp, -(long)(2 * sizeof(u_int32_t) + SKETCH_BYTES(sp)), SEEK_END) != 0
+	|| fread(sp->bits, 1, SKETCH_BYTES(sp), fp) != SKETCH_BYTES(sp))
+    {
+	sketch_free(sp);
+	sp = NULL;
+    }
+    fseek(fp, here, SEEK_SET);
+    return(sp);
+}
+
+void sketch_free(struct sketch_t *sp)
+/* release a sketch */
+{
+    free(sp->bits);
+    free(sp);
+}
+
+/* sketch.c ends here */
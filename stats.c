@@ -0,0 +1,351 @@
+/*
+ * stats.c -- phase timing and run statistics for comparator
+ *
+ * With --progress a ticker thread samples the run counters every few
+ * seconds and reports throughput, plus the share done and the time
+ * left of each phase that has said how much work it expects.  The
+ * counters are only ever added to atomically, so the shredding threads
+ * never wait on it.
+ *
+ * SPDX-License-Identifier: BSD-2-clause
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "shred.h"
+
+struct stats_t stats;
+__thread struct stats_t thread_stats;
+
+static const char *phase_names[NPHASES] = {
+    "walk", "shred", "scf_write", "scf_read", "sort",
+    "compact", "reduce", "collapse", "filter", "emit", "merge", "lsh",
+};
+
+/* phases that run in several threads at once accumulate all their time */
+static struct
+{
+    u_int64_t	elapsed;	/* total nanoseconds spent in phase */
+    u_int64_t	calls;		/* number of intervals */
+}
+phases[NPHASES];
+static __thread u_int64_t started[NPHASES];	/* start of current interval */
+
+#define PROGRESS_SECONDS	2	/* interval between progress reports */
+
+int progress_fd = -1;		/* where --progress reports go, -1 for none */
+static bool progress_json;
+static struct
+{
+    u_int64_t	total;		/* work units expected */
+    u_int64_t	done;		/* work units finished */
+    u_int64_t	since;		/* when the first were expected */
+    int		active;		/* threads inside the phase */
+}
+work[NPHASES];
+static pthread_mutex_t progress_lock = PTHREAD_MUTEX_INITIALIZER;
+static u_int64_t progress_began;
+static bool progress_over;
+
+u_int64_t monotonic_ns(void)
+/* nanoseconds since some arbitrary fixed point */
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((u_int64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+void phase_begin(int phase)
+/* start timing an interval of the given phase */
+{
+    started[phase] = monotonic_ns();
+    __atomic_fetch_add(&work[phase].active, 1, __ATOMIC_RELAXED);
+}
+
+void phase_end(int phase)
+/* finish timing an interval of the given phase */
+{
+    __atomic_fetch_add(&phases[phase].elapsed,
+		       monotonic_ns() - started[phase], __ATOMIC_RELAXED);
+    __atomic_fetch_add(&phases[phase].calls, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_sub(&work[phase].active, 1, __ATOMIC_RELAXED);
+}
+
+void progress_expect(int phase, u_int64_t total)
+/* announce work units a phase has yet to do */
+{
+    u_int64_t	zero = 0;
+
+    __atomic_compare_exchange_n(&work[phase].since, &zero, monotonic_ns(),
+				false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&work[phase].total, total, __ATOMIC_RELAXED);
+}
+
+void progress_advance(int phase, u_int64_t n)
+/* record work units a phase has finished */
+{
+    __atomic_fetch_add(&work[phase].done, n, __ATOMIC_RELAXED);
+}
+
+static double rate(u_int64_t count, u_int64_t before, double secs)
+/* a counter's increase per second */
+{
+    return((count > before) ? (count - before) / secs : 0);
+}
+
+static void progress_report(bool final)
+/* emit one progress line; the caller holds progress_lock */
+{
+    static u_int64_t	then, lines, bytes, shreds;
+    u_int64_t	now = monotonic_ns();
+    u_int64_t	nlines = __atomic_load_n(&stats.lines, __ATOMIC_RELAXED);
+    u_int64_t	nbytes = __atomic_load_n(&stats.bytes_read, __ATOMIC_RELAXED);
+    u_int64_t	nshreds = __atomic_load_n(&stats.shreds_generated, __ATOMIC_RELAXED)
+			+ __atomic_load_n(&stats.shreds_loaded, __ATOMIC_RELAXED);
+    double	secs, elapsed = (now - progress_began) / 1e9;
+    char	buf[BUFSIZ];
+    int		i, n, shown = 0;
+
+    /* the last line gives the averages over the run, the others are current */
+    if (final)
+    {
+	then = progress_began;
+	lines = bytes = shreds = 0;
+    }
+    else if (then == 0)
+	then = progress_began;
+    secs = (now > then) ? (now - then) / 1e9 : 1e-9;
+
+    if (progress_json)
+	n = snprintf(buf, sizeof(buf),
+		     "{\"elapsed\": %.1f, \"final\": %s, \"lines_per_s\": %.0f, "
+		     "\"mb_per_s\": %.2f, \"shreds_per_s\": %.0f, \"phases\": {",
+		     elapsed, final ? "true" : "false",
+		     rate(nlines, lines, secs), rate(nbytes, bytes, secs) / 1e6,
+		     rate(nshreds, shreds, secs));
+    else
+	n = snprintf(buf, sizeof(buf),
+		     "%% %s %.0fs: %.0f lines/s, %.2f MB/s, %.0f shreds/s",
+		     final ? "Finished in" : "Progress at", elapsed,
+		     rate(nlines, lines, secs), rate(nbytes, bytes, secs) / 1e6,
+		     rate(nshreds, shreds, secs));
+    for (i = 0; i < NPHASES && !final; i++)
+    {
+	u_int64_t	total = __atomic_load_n(&work[i].total, __ATOMIC_RELAXED);
+	u_int64_t	done = __atomic_load_n(&work[i].done, __ATOMIC_RELAXED);
+	double	spent, eta = -1;
+
+	/* phases are shown while they run or still have work expected */
+	if (__atomic_load_n(&work[i].active, __ATOMIC_RELAXED) == 0
+	    && (total == 0 || done >= total))
+	    continue;
+	if (done > total)
+	    done = total;
+	if (total && done)
+	{
+	    spent = (now - work[i].since) / 1e9;
+	    eta = spent * (total - done) / done;
+	}
+	if (n >= (int)sizeof(buf) - 128)
+	    break;
+	if (progress_json)
+	{
+	    n += snprintf(buf + n, sizeof(buf) - n, "%s\"%s\": {",
+			  shown ? ", " : "", phase_names[i]);
+	    if (total)
+		n += snprintf(buf + n, sizeof(buf) - n,
+			      "\"done\": %llu, \"total\": %llu, \"eta\": ",
+			      (unsigned long long)done,
+			      (unsigned long long)total);
+	    if (total && eta >= 0)
+		n += snprintf(buf + n, sizeof(buf) - n, "%.1f}", eta);
+	    else if (total)
+		n += snprintf(buf + n, sizeof(buf) - n, "null}");
+	    else
+		n += snprintf(buf + n, sizeof(buf) - n, "}");
+	}
+	else
+	{
+	    n += snprintf(buf + n, sizeof(buf) - n, "%s %s",
+			  shown ? "," : ";", phase_names[i]);
+	    if (total)
+		n += snprintf(buf + n, sizeof(buf) - n, " %.0f%%",
+			      done * 100.0 / total);
+	    if (eta >= 0)
+		n += snprintf(buf + n, sizeof(buf) - n, " (%.0fs left)", eta);
+	}
+	shown++;
+    }
+    n += snprintf(buf + n, sizeof(buf) - n, progress_json ? "}}\n" : "\n");
+
+    then = now;
+    lines = nlines;
+    bytes = nbytes;
+    shreds = nshreds;
+    if (write(progress_fd, buf, n) != n && !final)
+	progress_over = true;	/* nobody is listening */
+}
+
+static void *progress_ticker(void *arg)
+/* report progress until the run is over */
+{
+    struct timespec	interval = {PROGRESS_SECONDS, 0};
+
+    for (;;)
+    {
+	nanosleep(&interval, NULL);
+	pthread_mutex_lock(&progress_lock);
+	if (!progress_over)
+	    progress_report(false);
+	pthread_mutex_unlock(&progress_lock);
+    }
+    return(NULL);
+}
+
+static void progress_stop(void)
+/* report the run's averages and silence the ticker */
+{
+    pthread_mutex_lock(&progress_lock);
+    if (!progress_over)
+	progress_report(true);
+    progress_over = true;
+    pthread_mutex_unlock(&progress_lock);
+}
+
+void progress_start(int fd, bool json)
+/* start reporting progress to a file descriptor */
+{
+    pthread_t	ticker;
+
+    progress_fd = fd;
+    progress_json = json;
+    progress_began = monotonic_ns();
+    if (pthread_create(&ticker, NULL, progress_ticker, NULL))
+    {
+	perror("comparator: can't start progress reports");
+	exit(1);
+    }
+    pthread_detach(ticker);
+    atexit(progress_stop);
+}
+
+bool percent_display(void)
+/* show -v percentages?  They would garble --progress lines on stderr */
+{
+    return(verbose && !debug && progress_fd != STDERR_FILENO);
+}
+
+void percent_begin(void)
+/* leave room for a percent-done display */
+{
+    if (percent_display())
+	fputs("    ", stderr);
+}
+
+void percent_done(void)
+/* close a percent-done display at 100% */
+{
+    if (percent_display())
+	fputs("\b\b\b\b100%", stderr);
+}
+
+void flush_counts(void)
+/* add this thread's counts into the run's */
+{
+    u_int64_t	*to = (u_int64_t *)&stats, *from = (u_int64_t *)&thread_stats;
+    int		i;
+
+    for (i = 0; i < sizeof(struct stats_t) / sizeof(u_int64_t); i++)
+	if (from[i])
+	{
+	    __atomic_fetch_add(to + i, from[i], __ATOMIC_RELAXED);
+	    from[i] = 0;
+	}
+}
+
+long peak_rss(void)
+/* peak resident set size of this process in kilobytes */
+{
+    FILE	*fp = fopen("/proc/self/status", "r");
+    struct rusage ru;
+
+    /*
+     * Prefer VmHWM where we have it, because ru_maxrss also counts
+     * whatever the parent had resident when it forked us.
+     */
+    if (fp)
+    {
+	char	buf[BUFSIZ];
+	long	hwm = -1;
+
+	while (fgets(buf, sizeof(buf), fp))
+	    if (!strncmp(buf, "VmHWM:", 6))
+	    {
+		hwm = atol(buf + 6);
+		break;
+	    }
+	fclose(fp);
+	if (hwm >= 0)
+	    return(hwm);
+    }
+    getrusage(RUSAGE_SELF, &ru);
+    return(ru.ru_maxrss);
+}
+
+void write_stats(const char *file)
+/* dump phase timings and counters as JSON */
+{
+    FILE	*fp;
+    int		i;
+
+    if ((fp = fopen(file, "w")) == NULL)
+    {
+	perror("comparator: can't write statistics");
+	return;
+    }
+
+    fprintf(fp, "{\n  \"program\": \"comparator %s\",\n", VERSION);
+    fputs("  \"phases\": {\n", fp);
+    for (i = 0; i < NPHASES; i++)
+	fprintf(fp, "    \"%s\": {\"seconds\": %.9f, \"intervals\": %llu}%s\n",
+		phase_names[i],
+		phases[i].elapsed / 1e9,
+		(unsigned long long)phases[i].calls,
+		(i < NPHASES - 1) ? "," : "");
+    fputs("  },\n", fp);
+    fputs("  \"counters\": {\n", fp);
+#define COUNTER(name, last)	fprintf(fp, "    \"%s\": %llu%s\n", #name, \
+					(unsigned long long)stats.name, \
+					last ? "" : ",")
+    COUNTER(files, 0);
+    COUNTER(lines, 0);
+    COUNTER(regexec_calls, 0);
+    COUNTER(bytes_hashed, 0);
+    COUNTER(bytes_read, 0);
+    COUNTER(reallocs, 0);
+    COUNTER(shreds_generated, 0);
+    COUNTER(shreds_loaded, 0);
+    COUNTER(dropped_compact, 0);
+    COUNTER(dropped_reduce, 0);
+    COUNTER(dropped_collapse, 0);
+    COUNTER(dropped_filter, 0);
+    COUNTER(dropped_sketch, 0);
+    COUNTER(dropped_winnow, 0);
+    COUNTER(dropped_lsh, 0);
+    COUNTER(dropped_corpus, 0);
+    COUNTER(linecache_hits, 0);
+    COUNTER(linecache_misses, 1);
+#undef COUNTER
+    fputs("  },\n", fp);
+    fprintf(fp, "  \"peak_rss_kb\": %ld\n}\n", peak_rss());
+    fclose(fp);
+}
+
+/* stats.c ends here */